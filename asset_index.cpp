@@ -0,0 +1,204 @@
+#include "asset_index.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+const char* const asset_section_names[SECTION_COUNT] = {
+    "images", "sounds", "fonts", "shaders", "files", "platform"
+};
+
+const sound_offsets& get_sound_offsets(sound_format format) {
+    static const sound_offsets offsets_long =  {16, 20};
+    static const sound_offsets offsets_short = {4, 8};
+
+    if (format == sound_format::LONG)   return offsets_long;
+    if (format == sound_format::SHORT)  return offsets_short;
+
+    throw std::invalid_argument("get_sound_offsets: received invalid sound format");
+}
+
+static void push_entry(AssetIndex& index, uint32_t entry_offset, uint32_t payload_offset, uint32_t payload_size) {
+    index.entry_offset.push_back(entry_offset);
+    index.payload_offset.push_back(payload_offset);
+    index.payload_size.push_back(payload_size);
+    for (int i=0; i<ASSET_FIELD_COUNT; ++i) {
+        index.fields[i].push_back(0);
+    }
+}
+
+static void set_field(AssetIndex& index, int field, uint32_t val) {
+    index.fields[field].back() = val;
+}
+
+// Entry headers are read with unchecked loads. Instead of checking every read, each part of an
+// entry (fixed header, variable header, payload) is checked once against the file size before
+// anything in it is read. This is done in 64 bits so that offset + size can't wrap around. Payloads
+// are checked too, so everything in the index can be used without further checks.
+static inline bool in_file(uint64_t file_size, uint64_t offset, uint64_t size) {
+    return offset + size <= file_size;
+}
+
+static bool index_image(AssetIndex& index, const uint8_t* data, uint64_t file_size, uint32_t entry_offset) {
+    // Up to and including the extra float count
+    if (!in_file(file_size, entry_offset, 13)) return false;
+    const uint8_t* header = data + entry_offset;
+    uint16_t width        = read_little_endian_u16(header);
+    uint16_t height       = read_little_endian_u16(header + 2);
+    uint8_t  extra_float_count = header[12];
+    uint32_t size_offset  = 13 + extra_float_count * 8;
+
+    if (!in_file(file_size, entry_offset, size_offset + 4)) return false;
+    uint32_t size         = read_little_endian_u32(header + size_offset);
+
+    uint32_t payload_offset = entry_offset + size_offset + 4;
+    if (!in_file(file_size, payload_offset, size)) return false;
+
+    push_entry(index, entry_offset, payload_offset, size);
+    set_field(index, IMAGE_WIDTH, width);
+    set_field(index, IMAGE_HEIGHT, height);
+    set_field(index, IMAGE_EXTRA_FLOAT_COUNT, extra_float_count);
+    return true;
+}
+
+static bool index_sound(AssetIndex& index, const uint8_t* data, uint64_t file_size, uint32_t entry_offset, sound_format format) {
+    const sound_offsets& sound_offsets = get_sound_offsets(format);
+
+    // The whole header, the data follows right after it
+    if (!in_file(file_size, entry_offset, sound_offsets.data)) return false;
+    const uint8_t* header = data + entry_offset;
+    uint32_t audio_type = read_little_endian_u32(header);
+
+    uint32_t unknown1 = 0, sample_rate = 0, unknown3 = 0;
+    if (format == sound_format::LONG) {
+        unknown1    = read_little_endian_u32(header + 4);
+        sample_rate = read_little_endian_u32(header + 8);
+        unknown3    = header[12];
+    }
+
+    uint32_t size = read_little_endian_u32(header + sound_offsets.size);
+
+    uint32_t payload_offset = entry_offset + sound_offsets.data;
+    if (!in_file(file_size, payload_offset, size)) return false;
+
+    push_entry(index, entry_offset, payload_offset, size);
+    set_field(index, SOUND_TYPE, audio_type);
+    set_field(index, SOUND_UNKNOWN1, unknown1);
+    set_field(index, SOUND_SAMPLE_RATE, sample_rate);
+    set_field(index, SOUND_UNKNOWN3, unknown3);
+    return true;
+}
+
+static bool index_shader(AssetIndex& index, const uint8_t* data, uint64_t file_size, uint32_t entry_offset) {
+    if (!in_file(file_size, entry_offset, 4)) return false;
+    uint32_t size_vert = read_little_endian_u32(data + entry_offset);
+
+    // The vertex shader and the fragment shader's size
+    if (!in_file(file_size, entry_offset + 4ull, size_vert + 4ull)) return false;
+    uint32_t entry_offset_frag = entry_offset + 4 + size_vert;
+    uint32_t size_frag = read_little_endian_u32(data + entry_offset_frag);
+
+    if (!in_file(file_size, entry_offset_frag + 4ull, size_frag)) return false;
+
+    push_entry(index, entry_offset, entry_offset + 4, size_vert);
+    set_field(index, SHADER_FRAG_OFFSET, entry_offset_frag + 4);
+    set_field(index, SHADER_FRAG_SIZE, size_frag);
+    return true;
+}
+
+// The format of these entries isn't known, so the whole entry is treated as payload. Entries aren't
+// necessarily stored in the same order as the offset table (audio isn't), so the end of an entry is
+// the next offset in file order rather than the next one in the table.
+static bool index_blobs(AssetIndex& index, const std::vector<uint32_t>& entry_offsets, uint32_t data_end) {
+    std::vector<uint32_t> sorted(entry_offsets);
+    std::sort(sorted.begin(), sorted.end());
+    if (!sorted.empty() && sorted.back() > data_end) {
+        return false;
+    }
+    for (uint32_t entry_offset : entry_offsets) {
+        auto next = std::upper_bound(sorted.begin(), sorted.end(), entry_offset);
+        uint32_t end = next == sorted.end() ? data_end : *next;
+        push_entry(index, entry_offset, entry_offset, end - entry_offset);
+    }
+    return true;
+}
+
+int build_asset_index(AssetIndex& index, const asset_offsets& offsets, Buffer& buffer, sound_format format) {
+    const uint32_t table_offsets[SECTION_COUNT + 1] = {
+        offsets.images, offsets.sounds, offsets.fonts, offsets.shaders,
+        offsets.files, offsets.platform, offsets.sizes
+    };
+    const uint8_t* data = buffer.at(0);
+    const uint64_t file_size = buffer.get_size();
+
+    if (offsets.sizes == INVALID_OFFSET || !in_file(file_size, offsets.sizes, SECTION_COUNT * 4)) {
+        std::cerr << "type_sizes past the end of the file" << std::endl;
+        return 1;
+    }
+
+    // Data for the last section ends at the end of the file, the rest follow backwards from there
+    // (see find_asset_offsets).
+    uint32_t data_end[SECTION_COUNT];
+    uint64_t curr_end = file_size;
+    for (int section=SECTION_COUNT - 1; section>=0; --section) {
+        data_end[section] = curr_end;
+        uint32_t section_size = read_little_endian_u32(data + offsets.sizes + section * 4);
+        if (section_size > curr_end) {
+            std::cerr << "type_sizes add up to more than the file size" << std::endl;
+            return 1;
+        }
+        curr_end -= section_size;
+    }
+
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        index.section_begin[section] = index.entry_offset.size();
+
+        uint32_t table_start = table_offsets[section];
+        uint32_t table_end = table_offsets[section + 1];
+        if (table_start == INVALID_OFFSET || table_end == INVALID_OFFSET || table_start > table_end) {
+            std::cerr << "failed to find " << asset_section_names[section] << " offsets" << std::endl;
+            continue;
+        }
+        if (table_end > file_size) {
+            std::cerr << asset_section_names[section] << " offsets past the end of the file" << std::endl;
+            return 1;
+        }
+
+        std::vector<uint32_t> entry_offsets((table_end - table_start) / 4);
+        for (uint32_t i=0; i<entry_offsets.size(); ++i) {
+            entry_offsets[i] = read_little_endian_u32(data + table_start + i * 4);
+        }
+
+        bool valid = true;
+        switch (section) {
+            case SECTION_IMAGES:
+                for (uint32_t entry_offset : entry_offsets) {
+                    valid = valid && index_image(index, data, file_size, entry_offset);
+                }
+                break;
+            case SECTION_SOUNDS:
+                for (uint32_t entry_offset : entry_offsets) {
+                    valid = valid && index_sound(index, data, file_size, entry_offset, format);
+                }
+                break;
+            case SECTION_SHADERS:
+                for (uint32_t entry_offset : entry_offsets) {
+                    valid = valid && index_shader(index, data, file_size, entry_offset);
+                }
+                break;
+            default:
+                valid = index_blobs(index, entry_offsets, data_end[section]);
+                break;
+        }
+        if (!valid) {
+            std::cerr << "entry " << index.entry_offset.size() - index.section_begin[section]
+              << " of the " << asset_section_names[section] << " section goes past the end of the file" << std::endl;
+            return 1;
+        }
+    }
+    index.section_begin[SECTION_COUNT] = index.entry_offset.size();
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "util.hpp"
+
+#define INVALID_OFFSET 0xffffffff
+
+struct asset_offsets {
+    uint32_t images;
+    uint32_t sounds;
+    uint32_t fonts;
+    uint32_t shaders;
+    uint32_t files;
+    uint32_t platform;
+    uint32_t sizes;
+};
+
+// This refers to the format of entries in the archive,
+// not the format in the underlying audio container
+enum class sound_format {
+    INVALID,
+    LONG,       // Contains a bunch of extra metadata
+    SHORT       // Only contains underlying container type and size
+};
+
+struct sound_offsets {
+    uint32_t size;
+    uint32_t data;
+};
+
+const sound_offsets& get_sound_offsets(sound_format format);
+
+// In the order their offset tables (and data) appear in the file
+enum asset_section {
+    SECTION_IMAGES,
+    SECTION_SOUNDS,
+    SECTION_FONTS,
+    SECTION_SHADERS,
+    SECTION_FILES,
+    SECTION_PLATFORM,
+    SECTION_COUNT
+};
+
+extern const char* const asset_section_names[SECTION_COUNT];
+
+// Type-specific header fields, see AssetIndex::field. Fonts, files and platform
+// entries have no known header, their payload is the whole entry.
+enum image_field {
+    IMAGE_WIDTH,
+    IMAGE_HEIGHT,
+    IMAGE_EXTRA_FLOAT_COUNT
+};
+
+enum sound_field {
+    SOUND_TYPE,
+    SOUND_UNKNOWN1,     // Only present in sound_format::LONG archives, 0 otherwise
+    SOUND_SAMPLE_RATE,  // Same as above
+    SOUND_UNKNOWN3      // Same as above
+};
+
+enum shader_field {
+    SHADER_FRAG_OFFSET, // The payload is the vertex shader, this is where the fragment shader text begins
+    SHADER_FRAG_SIZE
+};
+
+constexpr const int ASSET_FIELD_COUNT = 4;
+
+// All entries of all sections, built in a single pass over the offset tables. Entries are stored
+// section after section, so the entry number used for output file names is `entry - begin(section)`.
+struct AssetIndex {
+    uint32_t section_begin[SECTION_COUNT + 1];
+
+    std::vector<uint32_t> entry_offset;
+    std::vector<uint32_t> payload_offset;
+    std::vector<uint32_t> payload_size;
+    std::vector<uint32_t> fields[ASSET_FIELD_COUNT];
+
+    inline uint32_t begin(asset_section section) const { return this->section_begin[section]; };
+    inline uint32_t end(asset_section section) const { return this->section_begin[section + 1]; };
+    inline uint32_t count(asset_section section) const { return end(section) - begin(section); };
+
+    inline uint32_t field(uint32_t entry, int field) const { return this->fields[field][entry]; };
+
+    // Where the entry's data (header and payload) ends
+    inline uint32_t entry_end(asset_section section, uint32_t entry) const {
+        if (section == SECTION_SHADERS) {
+            return field(entry, SHADER_FRAG_OFFSET) + field(entry, SHADER_FRAG_SIZE);
+        }
+        return this->payload_offset[entry] + this->payload_size[entry];
+    };
+};
+
+int build_asset_index(AssetIndex& index, const asset_offsets& offsets, Buffer& buffer, sound_format format);
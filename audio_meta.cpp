@@ -0,0 +1,193 @@
+#include "audio_meta.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+bool read_wav_info(const uint8_t* data, uint32_t size, audio_info& info) {
+    if (size < 12 || std::memcmp(data, "RIFF", 4) || std::memcmp(data + 8, "WAVE", 4)) {
+        return false;
+    }
+
+    uint32_t block_align = 0;
+    bool found_fmt = false;
+    uint64_t offset = 12;
+    while (offset + 8 <= size) {
+        const uint8_t* chunk = data + offset;
+        uint32_t chunk_size = read_little_endian_u32(chunk + 4);
+
+        if (!std::memcmp(chunk, "fmt ", 4)) {
+            if (chunk_size < 16 || offset + 8 + 16 > size) {
+                return false;
+            }
+            info.channels    = read_little_endian_u16(chunk + 10);
+            info.sample_rate = read_little_endian_u32(chunk + 12);
+            block_align      = read_little_endian_u16(chunk + 20);
+            found_fmt = true;
+        } else if (!std::memcmp(chunk, "data", 4)) {
+            // fmt has to come before data. A data chunk cut short by the end of the payload
+            // is counted for what's actually there.
+            if (!found_fmt || !block_align) {
+                return false;
+            }
+            uint64_t data_size = std::min<uint64_t>(chunk_size, size - offset - 8);
+            info.frames = data_size / block_align;
+            return true;
+        }
+
+        // Chunks are padded to an even size
+        offset += 8 + static_cast<uint64_t>(chunk_size) + (chunk_size & 1);
+    }
+    return false;
+}
+
+// Ogg page header: "OggS", version, flags, granule position (i64), serial, sequence number,
+// checksum, segment count, then the segment table
+static const uint32_t OGG_PAGE_HEADER_SIZE = 27;
+
+static bool is_ogg_page(const uint8_t* data, uint32_t size, uint32_t offset) {
+    if (static_cast<uint64_t>(offset) + OGG_PAGE_HEADER_SIZE > size) return false;
+    if (std::memcmp(data + offset, "OggS", 4) || data[offset + 4] != 0) return false;
+    uint32_t segment_count = data[offset + 26];
+    return static_cast<uint64_t>(offset) + OGG_PAGE_HEADER_SIZE + segment_count <= size;
+}
+
+// Ogg's CRC is the unreflected CRC-32 (polynomial 0x04c11db7, no final xor) over the whole page
+// with the checksum field taken as 0. It's only computed for the few pages the backward scan
+// stops at, so this goes bit by bit rather than with a table.
+static bool ogg_page_crc_matches(const uint8_t* data, uint32_t size, uint32_t offset) {
+    uint32_t segment_count = data[offset + 26];
+    uint64_t page_size = OGG_PAGE_HEADER_SIZE + segment_count;
+    for (uint32_t i=0; i<segment_count; ++i) {
+        page_size += data[offset + OGG_PAGE_HEADER_SIZE + i];
+    }
+    if (offset + page_size > size) {
+        return false;
+    }
+
+    uint32_t crc = 0;
+    for (uint32_t i=0; i<page_size; ++i) {
+        uint8_t byte = (i >= 22 && i < 26) ? 0 : data[offset + i];
+        crc ^= static_cast<uint32_t>(byte) << 24;
+        for (int bit=0; bit<8; ++bit) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc == read_little_endian_u32(data + offset + 22);
+}
+
+bool read_vorbis_info(const uint8_t* data, uint32_t size, audio_info& info) {
+    if (!is_ogg_page(data, size, 0)) {
+        return false;
+    }
+
+    // The identification header is the first packet of the first page
+    uint32_t packet = OGG_PAGE_HEADER_SIZE + data[26];
+    if (static_cast<uint64_t>(packet) + 16 > size || data[packet] != 1 || std::memcmp(data + packet + 1, "vorbis", 6)) {
+        return false;
+    }
+    info.channels    = data[packet + 11];
+    info.sample_rate = read_little_endian_u32(data + packet + 12);
+
+    // The granule position of the last page that finishes a packet is the total sample count.
+    // Pages that don't finish one have it set to -1. Only pages of the same logical stream as the
+    // first one count, and their checksum has to match, which skips an "OggS" that merely shows
+    // up inside packet data.
+    uint32_t serial = read_little_endian_u32(data + 14);
+    uint32_t last_possible = size >= OGG_PAGE_HEADER_SIZE ? size - OGG_PAGE_HEADER_SIZE : 0;
+    for (uint32_t offset = last_possible + 1; offset-- > 0;) {
+        if (data[offset] != 'O' || !is_ogg_page(data, size, offset)
+          || read_little_endian_u32(data + offset + 14) != serial || !ogg_page_crc_matches(data, size, offset)) {
+            continue;
+        }
+        uint64_t granule = static_cast<uint64_t>(read_little_endian_u32(data + offset + 6))
+          | static_cast<uint64_t>(read_little_endian_u32(data + offset + 10)) << 32;
+        if (granule != UINT64_MAX) {
+            info.frames = granule;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool read_audio_info(uint32_t audio_type, const uint8_t* data, uint32_t size, audio_info& info) {
+    if (audio_type == 1) return read_wav_info(data, size, info);
+    if (audio_type == 2) return read_vorbis_info(data, size, info);
+    return false;
+}
+
+static std::string format_audio_index_entry(const audio_index_entry& entry) {
+    std::ostringstream out;
+    out << "{\"index\": " << entry.entry_number
+      << ", \"file\": \"" << entry.filename << "\""
+      << ", \"size\": " << entry.size
+      << ", \"stream\": " << (entry.size > AUDIO_STREAM_THRESHOLD ? "true" : "false");
+    if (entry.parsed) {
+        double duration = entry.info.sample_rate ? static_cast<double>(entry.info.frames) / entry.info.sample_rate : 0;
+        out << ", \"channels\": " << entry.info.channels
+          << ", \"sample_rate\": " << entry.info.sample_rate
+          << ", \"frames\": " << entry.info.frames
+          << ", \"duration\": " << std::fixed << std::setprecision(3) << duration;
+    }
+    out << "}";
+    return out.str();
+}
+
+static int write_audio_index_lines(const std::string& path, const std::vector<std::string>& lines) {
+    std::ofstream out(path);
+    out << "[" << std::endl;
+    for (size_t i=0; i<lines.size(); ++i) {
+        out << "  " << lines[i] << (i + 1 < lines.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+    out.close();
+    if (!out) {
+        std::cerr << "failed to write " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int write_audio_index(const std::string& path, std::vector<audio_index_entry> entries) {
+    std::sort(entries.begin(), entries.end(), [](const audio_index_entry& a, const audio_index_entry& b) {
+        return a.entry_number < b.entry_number;
+    });
+    std::vector<std::string> lines;
+    for (const audio_index_entry& entry : entries) {
+        lines.push_back(format_audio_index_entry(entry));
+    }
+    return write_audio_index_lines(path, lines);
+}
+
+int merge_audio_indexes(const std::vector<std::string>& paths, const std::string& output_path) {
+    // Relies on the one entry per line layout write_audio_index uses
+    std::vector<std::pair<uint32_t, std::string>> entries;
+    for (const std::string& path : paths) {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            uint32_t entry_number;
+            if (std::sscanf(line.c_str(), " {\"index\": %u", &entry_number) != 1) {
+                continue;
+            }
+            line = line.substr(line.find('{'));
+            if (line.back() == ',') line.pop_back();
+            entries.emplace_back(entry_number, line);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+
+    std::vector<std::string> lines;
+    for (auto& entry : entries) {
+        lines.push_back(entry.second);
+    }
+    return write_audio_index_lines(output_path, lines);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Entries larger than this are streamed by the game rather than loaded into memory at once
+// (see AssetEntrySound in the README)
+constexpr const uint32_t AUDIO_STREAM_THRESHOLD = 0x80000;
+
+// Written next to the extracted audio
+#define AUDIO_INDEX_FILENAME "audio-index.json"
+
+// What can be learned about an audio payload from its container headers, without decoding it
+struct audio_info {
+    uint32_t channels = 0;
+    uint32_t sample_rate = 0;
+    uint64_t frames = 0;        // Samples per channel
+};
+
+// Both read only the headers (and for Ogg, the last page) straight from `data`, which is `size`
+// bytes long. Return false if the payload isn't a container they understand.
+bool read_wav_info(const uint8_t* data, uint32_t size, audio_info& info);
+bool read_vorbis_info(const uint8_t* data, uint32_t size, audio_info& info);
+
+// Picks the parser by the entry's audio_type (1 = wav, 2 = ogg)
+bool read_audio_info(uint32_t audio_type, const uint8_t* data, uint32_t size, audio_info& info);
+
+// One line of the audio index extract_audio writes
+struct audio_index_entry {
+    uint32_t entry_number;
+    std::string filename;
+    uint32_t size;
+    bool parsed;
+    audio_info info;
+};
+
+// Writes the entries as a JSON array, one entry per line. Returns 0 on success.
+int write_audio_index(const std::string& path, std::vector<audio_index_entry> entries);
+
+// Combines audio indexes written by different shards into one, ordered by entry number.
+// Returns 0 on success.
+int merge_audio_indexes(const std::vector<std::string>& paths, const std::string& output_path);
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <vector>
 
 uint32_t read_variable_length_size(Buffer& buffer, uint8_t nibble) {
     uint32_t len = nibble;
@@ -18,34 +19,77 @@ uint32_t read_variable_length_size(Buffer& buffer, uint8_t nibble) {
     return len;
 }
 
-int read_hunk(Buffer& out_buffer, Buffer& buffer) {
+// Drops the output before `keep_from` (counted from the start of the hunk) once there's at least
+// MAX_REWIND_DISTANCE of it, so that skipping a long stretch of a hunk needs a bounded amount of room
+static void drop_skipped_output(Buffer& out_buffer, uint32_t hunk_start, uint32_t& window_start, uint32_t keep_from) {
+    if (keep_from - window_start < MAX_REWIND_DISTANCE) {
+        return;
+    }
+    uint32_t kept = out_buffer.tell() - hunk_start - (keep_from - window_start);
+    std::memmove(out_buffer.at(hunk_start), out_buffer.at(out_buffer.tell() - kept), kept);
+    out_buffer.seek(hunk_start + kept, Buffer::SET);
+    window_start = keep_from;
+}
+
+// Decodes bytes [skip_size, max_decompressed_size) of the hunk's output to out_buffer. The bytes
+// before skip_size still have to be decoded, since matches can refer back to them, but only the last
+// MAX_REWIND_DISTANCE of them are kept, which takes less than CHOWIMG_SKIP_SCRATCH past what's written.
+// Literals and matches have to stay within the hunk, on both the input and the output side.
+int read_hunk(Buffer& out_buffer, Buffer& buffer, uint32_t skip_size, uint32_t max_decompressed_size) {
     uint32_t hunk_compressed_size = buffer.read_u32();
+    if (hunk_compressed_size > buffer.get_size() - buffer.tell()) {
+        std::cerr << "read_hunk: hunk is larger than the input (size=" << hunk_compressed_size
+            << ", input left=" << buffer.get_size() - buffer.tell() << ")" << std::endl;
+        return 1;
+    }
     uint32_t hunk_decompressed_size = 0;
+    uint32_t hunk_start = out_buffer.tell();
+    // The hunk output at out_buffer's hunk_start, everything before it has been dropped
+    uint32_t window_start = 0;
     uint32_t max_offset = buffer.tell() + hunk_compressed_size;
-    out_buffer.ensure_writable(hunk_compressed_size);
-    while(buffer.tell() < max_offset) {
+    // What can't be dropped yet: the output that's wanted and whatever a match can still reach
+    auto keep_from = [&]() {
+        return std::min(skip_size, hunk_decompressed_size > MAX_REWIND_DISTANCE
+          ? hunk_decompressed_size - MAX_REWIND_DISTANCE : 0);
+    };
+
+    while(buffer.tell() < max_offset && hunk_decompressed_size < max_decompressed_size) {
         uint8_t control_byte = buffer.read_u8();
 
         uint8_t first_nibble = control_byte >> 4;
         uint8_t second_nibble = control_byte & 0xf;
 
         uint32_t bytes_to_copy_count = read_variable_length_size(buffer, first_nibble);
-        out_buffer.ensure_writable(bytes_to_copy_count);
-        out_buffer.write(buffer.at(buffer.tell()), bytes_to_copy_count);
+        if (buffer.tell() > max_offset || bytes_to_copy_count > max_offset - buffer.tell()) {
+            std::cerr << "read_hunk: literals run past the end of the hunk (count="
+                << bytes_to_copy_count << ", hunk bytes left=" 
+                << (buffer.tell() > max_offset ? 0 : max_offset - buffer.tell()) << ")" << std::endl;
+            return 1;
+        }
 
-        buffer.seek(bytes_to_copy_count, Buffer::Whence::CURR);
-        hunk_decompressed_size += bytes_to_copy_count;
+        // Copied a piece at a time, so that the skipped output can be dropped in between
+        uint32_t literals_end = buffer.tell() + bytes_to_copy_count;
+        uint32_t literals_left = std::min(bytes_to_copy_count, max_decompressed_size - hunk_decompressed_size);
+        while (literals_left) {
+            drop_skipped_output(out_buffer, hunk_start, window_start, keep_from());
+            uint32_t piece = std::min(literals_left, MAX_REWIND_DISTANCE);
+            out_buffer.ensure_writable(piece);
+            out_buffer.write(buffer.at(buffer.tell()), piece);
+            buffer.seek(piece, Buffer::Whence::CURR);
+            hunk_decompressed_size += piece;
+            literals_left -= piece;
+        }
+        buffer.seek(literals_end, Buffer::SET);
 
-        if (buffer.tell() >= max_offset) {
+        if (buffer.tell() >= max_offset || hunk_decompressed_size >= max_decompressed_size) {
             break;
         }
 
         uint16_t rewind_distance = buffer.read_u16();
 
-        uint32_t rewind_start = hunk_decompressed_size - rewind_distance;
-
-        if (rewind_distance > hunk_decompressed_size) {
-            std::cerr << "read_hunk: rewind distance underflows the hunk (dist=" 
+        // Distances are relative to the hunk, which is why hunks can be decoded on their own
+        if (rewind_distance == 0 || rewind_distance > hunk_decompressed_size) {
+            std::cerr << "read_hunk: rewind distance is outside of the hunk (dist=" 
                 << rewind_distance << ", hunk_decompressed_size=" << hunk_decompressed_size
                 << ")"  << std::endl;
             return 1;
@@ -53,25 +97,111 @@ int read_hunk(Buffer& out_buffer, Buffer& buffer) {
 
         uint32_t rewind_byte_count = read_variable_length_size(
             buffer, second_nibble) + 4;
-        
-        out_buffer.ensure_writable(rewind_byte_count);
-
-        // std::cout << "copy from " << rewind_start << " to " << out_buffer.tell() << " x" 
-        //     << rewind_byte_count << std::endl; 
-    
-        out_buffer.copy_from_self(rewind_start, rewind_byte_count);
+        if (buffer.tell() > max_offset) {
+            std::cerr << "read_hunk: match length runs past the end of the hunk" << std::endl;
+            return 1;
+        }
 
-        hunk_decompressed_size += rewind_byte_count;
+        // The output that was dropped is always more than MAX_REWIND_DISTANCE back, so the start
+        // of the match is still there
+        uint32_t match_left = std::min(rewind_byte_count, max_decompressed_size - hunk_decompressed_size);
+        while (match_left) {
+            drop_skipped_output(out_buffer, hunk_start, window_start, keep_from());
+            uint32_t piece = std::min(match_left, MAX_REWIND_DISTANCE);
+            out_buffer.ensure_writable(piece);
+            out_buffer.copy_from_self(out_buffer.tell() - rewind_distance, piece);
+            hunk_decompressed_size += piece;
+            match_left -= piece;
+        }
     }
+
+    // Whatever is left of the skipped part
+    uint32_t skipped = std::min(skip_size, hunk_decompressed_size) - window_start;
+    uint32_t kept = out_buffer.tell() - hunk_start - skipped;
+    std::memmove(out_buffer.at(hunk_start), out_buffer.at(hunk_start + skipped), kept);
+    out_buffer.seek(hunk_start + kept, Buffer::SET);
     return 0;
 }
 
 int chowimg_read(Buffer& out_buffer, Buffer& buffer, uint32_t max_offset) {
     while (buffer.tell() < max_offset) {
-        int res = read_hunk(out_buffer, buffer);
+        int res = read_hunk(out_buffer, buffer, 0, UINT32_MAX);
         if (res) {
             return 1;
         }
+        if (buffer.tell() > max_offset) {
+            std::cerr << "chowimg_read: last hunk runs past the end of the image data" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int chowimg_scan_hunks(std::vector<chowimg_hunk>& hunks, Buffer& buffer, uint32_t max_offset, uint32_t max_decompressed_size) {
+    uint64_t decompressed_size = 0;
+    while (buffer.tell() < max_offset && decompressed_size < max_decompressed_size) {
+        chowimg_hunk hunk = {buffer.tell(), 0};
+        uint32_t hunk_compressed_size = buffer.read_u32();
+        if (buffer.tell() > max_offset || hunk_compressed_size > max_offset - buffer.tell()) {
+            return 1;
+        }
+        uint32_t hunk_end = buffer.tell() + hunk_compressed_size;
+
+        // Same structure and checks as in read_hunk, minus the copying
+        while (buffer.tell() < hunk_end) {
+            uint8_t control_byte = buffer.read_u8();
+            uint32_t literal_count = read_variable_length_size(buffer, control_byte >> 4);
+            if (buffer.tell() > hunk_end || literal_count > hunk_end - buffer.tell()) {
+                return 1;
+            }
+            buffer.seek(literal_count, Buffer::Whence::CURR);
+            hunk.decompressed_size += literal_count;
+
+            if (buffer.tell() >= hunk_end) {
+                break;
+            }
+
+            uint16_t rewind_distance = buffer.read_u16();
+            if (rewind_distance == 0 || rewind_distance > hunk.decompressed_size) {
+                return 1;
+            }
+            hunk.decompressed_size += read_variable_length_size(buffer, control_byte & 0xf) + 4;
+            if (buffer.tell() > hunk_end) {
+                return 1;
+            }
+        }
+        hunks.push_back(hunk);
+        decompressed_size += hunk.decompressed_size;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+int chowimg_read_range(Buffer& out_buffer, Buffer& buffer, uint32_t max_offset, uint32_t start, uint32_t end) {
+    std::vector<chowimg_hunk> hunks;
+    if (chowimg_scan_hunks(hunks, buffer, max_offset, end)) {
+        return 1;
+    }
+
+    uint32_t hunk_output_start = 0;
+    for (const chowimg_hunk& hunk : hunks) {
+        uint32_t hunk_output_end = hunk_output_start + hunk.decompressed_size;
+        if (hunk_output_end > start) {
+            // Only the first hunk can start before the range and only the last one end after it
+            uint32_t skip_size = start > hunk_output_start ? start - hunk_output_start : 0;
+            buffer.seek(hunk.offset, Buffer::SET);
+            if (read_hunk(out_buffer, buffer, skip_size, end - hunk_output_start)) {
+                return 1;
+            }
+        }
+        hunk_output_start = hunk_output_end;
+        if (hunk_output_start >= end) {
+            break;
+        }
+    }
+
+    if (hunk_output_start < end) {
+        std::cerr << "chowimg_read_range: image data ends before the requested range" << std::endl;
+        return 1;
+    }
+    return 0;
+}
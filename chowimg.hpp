@@ -1,6 +1,29 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 #include "util.hpp"
 
+// Matches can only refer this far back into the hunk's output
+constexpr const uint32_t MAX_REWIND_DISTANCE = 0xffff;
+
+// How much room past the bytes it produces chowimg_read_range may use in out_buffer, for the part of
+// the first hunk that is skipped over
+constexpr const uint32_t CHOWIMG_SKIP_SCRATCH = 3 * MAX_REWIND_DISTANCE;
+
+struct chowimg_hunk {
+    uint32_t offset;            // Where the hunk (its size dword) starts in the input
+    uint32_t decompressed_size;
+};
+
 int chowimg_read(Buffer& out_buffer, Buffer& buffer, uint32_t max_offset);
+
+// Finds where every hunk starts and how much it decompresses to, without decompressing anything.
+// Stops after the hunk that brings the output to max_decompressed_size bytes (UINT32_MAX for all).
+int chowimg_scan_hunks(std::vector<chowimg_hunk>& hunks, Buffer& buffer, uint32_t max_offset, uint32_t max_decompressed_size);
+
+// Decompresses only bytes [start, end) of the output. Hunks don't refer to each other, so the ones
+// before `start` are skipped and decoding stops once `end` is reached. The bytes are written at the
+// current offset of out_buffer, which is advanced by end - start, and out_buffer only has to be
+// CHOWIMG_SKIP_SCRATCH larger than that, however long the hunks are.
+int chowimg_read_range(Buffer& out_buffer, Buffer& buffer, uint32_t max_offset, uint32_t start, uint32_t end);
@@ -1,91 +1,284 @@
+#include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <boost/program_options/options_description.hpp>
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
-#include "stb/stb_image_write.h"
 #include "chowimg.hpp"
+#include "parallel.hpp"
+#include "png_write.hpp"
+#include "scratch_pool.hpp"
 
 namespace po = boost::program_options;
+namespace fs = boost::filesystem;
 
 #define PROJECT_NAME "chowimg"
 
-void print_help() {
+struct batch_item {
+    std::string input;
+    std::string output;
+    int width;
+    int height;
+};
+
+std::mutex log_mutex;
+
+void print_help(const po::options_description& opt_desc) {
     std::cout << "usage: " PROJECT_NAME " input.bin width height output.png" << std::endl;
+    std::cout << "       " PROJECT_NAME " --batch [options] inputs..." << std::endl;
+    opt_desc.print(std::cout);
+}
+
+// Gets the image size from the -WxH.bin suffix that cyber-shadow-extractor --image-format raw
+// gives its files, and the name without it (image3-64x40.bin -> image3)
+bool parse_raw_filename(const std::string& filename, int& width, int& height, std::string& stem) {
+    const std::string extension = ".bin";
+    if (filename.size() <= extension.size() || filename.compare(filename.size() - extension.size(), extension.size(), extension)) {
+        return false;
+    }
+    std::string name = filename.substr(0, filename.size() - extension.size());
+
+    size_t dash = name.rfind('-');
+    if (dash == std::string::npos) {
+        return false;
+    }
+    char trailing;
+    if (std::sscanf(name.c_str() + dash + 1, "%dx%d%c", &width, &height, &trailing) != 2) {
+        return false;
+    }
+    stem = name.substr(0, dash);
+    return width > 0 && height > 0;
+}
+
+// Returns 0 on success
+int convert(const std::string& input_name, int width, int height, const std::string& output_name,
+  BufferAllocator& allocator, unsigned png_jobs) {
+    FILE* input = fopen(input_name.c_str(), "rb");
+    if (!input) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << input_name << ": failed to open input file" << std::endl;
+        return 1;
+    }
+
+    Buffer in_buffer(input);
+    fclose(input);
+
+    uint64_t decoded_size = static_cast<uint64_t>(width) * height * 4;
+    if (decoded_size > UINT32_MAX) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << input_name << ": a " << width << "x" << height << " image is too large to decode" << std::endl;
+        return 1;
+    }
+    Buffer out_buffer(decoded_size, allocator);
+
+    int res;
+    try {
+        res = chowimg_read(out_buffer, in_buffer, in_buffer.get_size());
+    } catch (std::range_error&) {
+        res = 1;
+    }
+    if (res || out_buffer.tell() < decoded_size) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << input_name << ": failed to decompress a " << width << "x" << height << " image" << std::endl;
+        return 1;
+    }
+
+    res = write_png(output_name, width, height, out_buffer.at(0), png_jobs);
+    if (res) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << "failed to write image to file " << output_name << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Returns false if the file isn't named like a raw image
+bool add_batch_item(std::vector<batch_item>& items, const fs::path& path, const std::string& output_dir) {
+    batch_item item;
+    std::string stem;
+    if (!parse_raw_filename(path.filename().string(), item.width, item.height, stem)) {
+        std::cerr << path.string() << ": can't tell the image size, expected a name ending in -WxH.bin" << std::endl;
+        return false;
+    }
+    item.input = path.string();
+    fs::path output_path = output_dir.empty() ? path.parent_path() : fs::path(output_dir);
+    item.output = (output_path / (stem + ".png")).string();
+    items.push_back(item);
+    return true;
+}
+
+// Directories contribute all of their .bin files, list files one path per line. Returns how many
+// inputs had to be skipped (missing, unreadable or not named like a raw image).
+uint32_t collect_batch_items(std::vector<batch_item>& items, const std::vector<std::string>& inputs,
+  const std::string& file_list, const std::string& output_dir) {
+    uint32_t rejected = 0;
+    std::vector<std::string> paths(inputs);
+    if (!file_list.empty()) {
+        std::ifstream list(file_list);
+        if (!list) {
+            std::cerr << file_list << ": failed to open file list" << std::endl;
+            ++rejected;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty()) paths.push_back(line);
+        }
+    }
+
+    for (const std::string& path : paths) {
+        boost::system::error_code error;
+        fs::file_status status = fs::status(path, error);
+        if (!error && !fs::exists(status)) {
+            error = boost::system::errc::make_error_code(boost::system::errc::no_such_file_or_directory);
+        }
+        if (error) {
+            std::cerr << path << ": " << error.message() << std::endl;
+            ++rejected;
+            continue;
+        }
+
+        if (!fs::is_directory(status)) {
+            rejected += add_batch_item(items, path, output_dir) ? 0 : 1;
+            continue;
+        }
+
+        std::vector<fs::path> files;
+        fs::directory_iterator dir_iterator(path, error);
+        for (; !error && dir_iterator != fs::directory_iterator(); dir_iterator.increment(error)) {
+            const fs::path& file = dir_iterator->path();
+            if (file.extension() == ".bin" && fs::is_regular_file(file, error)) {
+                files.push_back(file);
+            }
+        }
+        if (error) {
+            std::cerr << path << ": " << error.message() << std::endl;
+            ++rejected;
+            continue;
+        }
+
+        std::sort(files.begin(), files.end());
+        for (const fs::path& file : files) {
+            rejected += add_batch_item(items, file, output_dir) ? 0 : 1;
+        }
+    }
+    return rejected;
 }
 
 int main(int argc, char** argv) {
     po::variables_map opts;
 
-    po::options_description opt_desc;
+    po::options_description opt_desc("Named options");
     opt_desc.add_options()(
-        "input",
-        "input file containing raw compressed data"
+        "batch",
+        "treat all arguments as inputs: either files named like the raw images that "
+        "cyber-shadow-extractor writes (imageN-WxH.bin) or directories containing them"
+    )(
+        "file-list",
+        po::value<std::string>(),
+        "with --batch, also read input paths from this file, one per line"
     )(
-        "output",
-        "where to write the output"
+        "output-dir",
+        po::value<std::string>(),
+        "with --batch, where to write the images (default: next to the inputs)"
     )(
-        "width",
-        po::value<int>(),
-        "width of the png image that should be created from raw data"
+        "jobs,j",
+        po::value<unsigned>()->default_value(0),
+        "number of images to convert at once (0 = one per CPU core)"
     )(
-        "height",
-        po::value<int>(),
-        "height of the png image that should be created from raw data"
+        "help",
+        "print help message"
     );
 
+    po::options_description hidden_desc;
+    hidden_desc.add_options()(
+        "args",
+        po::value<std::vector<std::string>>()->default_value({}, ""),
+        "input.bin width height output.png, or inputs with --batch"
+    );
+
+    po::options_description all_desc;
+    all_desc.add(opt_desc).add(hidden_desc);
+
     po::positional_options_description positional_desc;
-    positional_desc.add("input", 1).add("width", 1).add("height", 1).add("output", 1);
+    positional_desc.add("args", -1);
 
     try {
         po::store(
             po::command_line_parser(argc, argv)
-              .options(opt_desc).positional(positional_desc).run(),
+              .options(all_desc).positional(positional_desc).run(),
             opts);
     } catch(std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
     }
 
-    
-    if (opts.count("input") == 0 || opts.count("output") == 0) {
-        print_help();
-        return 1;
+    if (opts.count("help")) {
+        print_help(opt_desc);
+        return 0;
     }
 
-    auto& input_name = opts["input"].as<std::string>();
-    auto& output_name = opts["output"].as<std::string>();
+    auto& args = opts["args"].as<std::vector<std::string>>();
+    unsigned jobs = opts["jobs"].as<unsigned>();
+    if (jobs == 0) {
+        jobs = default_job_count();
+    }
 
-    int width  = opts["width"].as<int>();
-    int height = opts["height"].as<int>();
-    if (width <= 0 || height <= 0) {
-        std::cerr << "invalid image dimensions" << std::endl;
-        return 1;
+    if (!opts.count("batch")) {
+        if (args.size() != 4) {
+            print_help(opt_desc);
+            return 1;
+        }
+
+        int width  = std::atoi(args[1].c_str());
+        int height = std::atoi(args[2].c_str());
+        if (width <= 0 || height <= 0) {
+            std::cerr << "invalid image dimensions" << std::endl;
+            return 1;
+        }
+        return convert(args[0], width, height, args[3], malloc_allocator(), jobs);
     }
 
-    FILE* input = fopen(input_name.c_str(), "rb");
-    if (!input) {
-        std::cerr << "failed to open input file" << std::endl;
+    std::string output_dir = opts.count("output-dir") ? opts["output-dir"].as<std::string>() : "";
+    std::string file_list = opts.count("file-list") ? opts["file-list"].as<std::string>() : "";
+    if (!output_dir.empty() && !fs::is_directory(output_dir)) {
+        std::cerr << output_dir << ": directory does not exist" << std::endl;
         return 1;
     }
 
-    Buffer in_buffer(input);
-    fclose(input);
-
-    Buffer out_buffer(0xffff);
+    std::vector<batch_item> items;
+    uint32_t rejected = collect_batch_items(items, args, file_list, output_dir);
 
-    int res = chowimg_read(out_buffer, in_buffer, in_buffer.get_size());
-    if (res) {
-        return 1;
+    // Decode buffers are reused between the images a worker converts
+    std::vector<std::unique_ptr<ScratchPool>> pools;
+    for (unsigned worker=0; worker<jobs; ++worker) {
+        pools.emplace_back(new ScratchPool(DEFAULT_SCRATCH_RETAIN_LIMIT, false));
     }
 
-    res = stbi_write_png(output_name.c_str(), width, height, 4, out_buffer.at(0), width * 4);
-    if (!res) {
-        std::cerr << "failed to write image to file " << output_name << std::endl;
-        return 1;
-    }
+    // Images big enough for write_png to split are converted after the rest, with all the jobs
+    auto large_png = [&](uint32_t i) {
+        return static_cast<uint64_t>(items[i].width) * items[i].height >= PARALLEL_PNG_MIN_PIXELS;
+    };
 
-    return 0;
+    // Inputs that couldn't even be queued count as failed conversions
+    std::atomic<uint32_t> failed(rejected);
+    parallel_for_large_last(jobs, items.size(), large_png, [&](uint32_t i, unsigned worker, unsigned png_jobs) {
+        const batch_item& item = items[i];
+        if (convert(item.input, item.width, item.height, item.output, *pools[worker], png_jobs)) {
+            ++failed;
+        }
+    });
+
+    uint32_t total = items.size() + rejected;
+    std::cout << "Converted " << total - failed << " of " << total << " images" << std::endl;
+    return failed ? 1 : 0;
 }
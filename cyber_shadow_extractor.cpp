@@ -26,6 +26,8 @@ For more information, please refer to <http://unlicense.org/>
 */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <boost/filesystem/file_status.hpp>
 #include <boost/program_options.hpp>
 #include <boost/program_options/errors.hpp>
@@ -40,20 +42,31 @@ For more information, please refer to <http://unlicense.org/>
 #include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <iomanip>
 #include <ios>
 #include <iostream>
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <stdexcept>
 #include <string>
-#include <zlib.h>
+#include <vector>
 
-#include "stb/stb_image_write.h"
 #include "util.hpp"
-#include "chowimg.hpp"
+#include "asset_index.hpp"
+#include "audio_meta.hpp"
+#include "memory_budget.hpp"
+#include "parallel.hpp"
+#include "image_codec.hpp"
+#include "io_plan.hpp"
+#include "png_write.hpp"
+#include "thumbnail.hpp"
+#include "scratch_pool.hpp"
+#include "shard.hpp"
+#include "stb/stb_image_write.h"
 
 #define PROJECT_NAME "cyber-shadow-extractor"
-#define INVALID_OFFSET 0xffffffff
 
 const std::string extension_ogg = ".ogg";
 const std::string extension_wav = ".wav";
@@ -61,38 +74,21 @@ const std::string extension_wav = ".wav";
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-struct asset_offsets {
-    uint32_t images;
-    uint32_t sounds;
-    uint32_t fonts;
-    uint32_t shaders;
-    uint32_t files;
-    uint32_t platform;
-    uint32_t sizes;
-};
-
 enum class image_format {
     INVALID,
-    ZLIB,
-    RAW,
-    CHOWIMG
+    AUTO,       // Pick a codec for every image by sniffing its payload
+    CODEC,      // Decode every image with the same codec
+    RAW
 };
 
-// This refers to the format of entries in the archive,
-// not the format in the underlying audio container
-enum class sound_format {
-    INVALID,
-    LONG,       // Contains a bunch of extra metadata
-    SHORT       // Only contains underlying container type and size
-};
-
-image_format get_image_format(const std::string& name) {
-    if (name == "zlib") {
-        return image_format::ZLIB;
-    } else if (name == "chowimg") {
-        return image_format::CHOWIMG;
+image_format get_image_format(const std::string& name, const ImageCodec*& codec) {
+    codec = nullptr;
+    if (name == "auto") {
+        return image_format::AUTO;
     } else if (name == "raw") {
         return image_format::RAW;
+    } else if ((codec = find_image_codec(name))) {
+        return image_format::CODEC;
     } else {
         return image_format::INVALID;
     }
@@ -108,21 +104,6 @@ sound_format get_sound_format(const std::string& name) {
     }
 }
 
-struct sound_offsets {
-    uint32_t size;
-    uint32_t data;
-};
-
-const sound_offsets& get_sound_offsets(sound_format format) {
-    static const sound_offsets offsets_long =  {16, 20};
-    static const sound_offsets offsets_short = {4, 8};
-
-    if (format == sound_format::LONG)   return offsets_long;
-    if (format == sound_format::SHORT)  return offsets_short;
-
-    throw std::invalid_argument("get_sound_offsets: received invalid sound format");
-}
-
 int parse_args(po::variables_map& opts, int argc, char** argv) {
     po::options_description optdesc_named("Named options");
     optdesc_named.add_options()
@@ -130,11 +111,44 @@ int parse_args(po::variables_map& opts, int argc, char** argv) {
             "probe-offsets",
             "only find offsets and exit"
         )
+        (
+            "list",
+            "only read entry headers and list what the archive contains, without extracting anything"
+        )
+        (
+            "json",
+            "with --list, print the listing as JSON"
+        )
+        (
+            "diff",
+            po::value<std::string>(),
+            "compare the input with this older version of the archive and list which entries were "
+            "changed, added or removed; if an output directory is given, only those are extracted"
+        )
+        (
+            "verify",
+            "decode and check every image, audio and shader entry without writing anything, "
+            "then print how many passed and how fast it went"
+        )
+        (
+            "shard",
+            po::value<std::string>(),
+            "only extract this process's part of the entries, given as K/N (shard K of N, "
+            "counting from 1). Entries are split the same way in every process, balanced by size, "
+            "and each shard leaves a summary in the output directory"
+        )
+        (
+            "merge-shards",
+            po::value<std::string>(),
+            "combine the shard summaries in this output directory, check that all shards "
+            "ran and print the totals"
+        )
         (
             "image-format",
             po::value<std::string>()->default_value("zlib"),
             "how to handle image data in the archive:\n"
             "- zlib (decompress with zlib)\n"
+            "- auto (detect the format of each image)\n"
             "- chowimg (decompress using custom algorhitm)\n"
             "- raw (extract raw data without decompression)"
         )
@@ -146,6 +160,39 @@ int parse_args(po::variables_map& opts, int argc, char** argv) {
             "- short\n"
             "if you're unsure what format your archive has, try both and see which works"
         )
+        (
+            "jobs,j",
+            po::value<unsigned>()->default_value(0),
+            "number of images to decode at once (0 = one per CPU core)"
+        )
+        (
+            "max-memory",
+            po::value<uint64_t>()->default_value(0),
+            "limit on the memory used for decoding images at once, in MiB (0 = no limit), "
+            "a quarter of which goes to buffers kept for reuse. Images larger than the rest "
+            "are decoded one at a time"
+        )
+        (
+            "image",
+            po::value<uint32_t>(),
+            "only extract the image with this number"
+        )
+        (
+            "region",
+            po::value<std::string>(),
+            "only decode this part of images, given as WxH+X+Y (clipped to the image size); "
+            "only the data up to the last row of the region is decompressed"
+        )
+        (
+            "thumbnails",
+            po::value<uint32_t>(),
+            "write scaled down previews that fit in a SIZE x SIZE square instead of full images, "
+            "using fast PNG compression"
+        )
+        (
+            "huge-pages",
+            "back large image decode buffers with transparent huge pages (Linux only)"
+        )
         (
             "no-images",
             "skip extracting images"
@@ -158,6 +205,18 @@ int parse_args(po::variables_map& opts, int argc, char** argv) {
             "no-shaders",
             "skip extracting shaders"
         )
+        (
+            "no-fonts",
+            "skip extracting fonts"
+        )
+        (
+            "no-files",
+            "skip extracting files"
+        )
+        (
+            "no-platform",
+            "skip extracting platform data"
+        )
         (
             "help",
             "print help message"
@@ -190,8 +249,15 @@ int parse_args(po::variables_map& opts, int argc, char** argv) {
         return 1;
     }
 
-    if (!opts.count("input") || !opts.count("output") || opts.count("help")) {
+    bool needs_input = !opts.count("merge-shards");
+    bool needs_output = needs_input && !opts.count("probe-offsets") && !opts.count("list") && !opts.count("verify") && !opts.count("diff");
+    if ((needs_input && !opts.count("input")) || (needs_output && !opts.count("output")) || opts.count("help")) {
         std::cout << "Usage: " PROJECT_NAME " [options] input.dat output-dir" << std::endl;
+        std::cout << "       " PROJECT_NAME " --list [--json] [options] input.dat" << std::endl;
+        std::cout << "       " PROJECT_NAME " --verify [options] input.dat" << std::endl;
+        std::cout << "       " PROJECT_NAME " --diff old.dat [options] new.dat [output-dir]" << std::endl;
+        std::cout << "       " PROJECT_NAME " --shard K/N [options] input.dat output-dir" << std::endl;
+        std::cout << "       " PROJECT_NAME " --merge-shards output-dir" << std::endl;
         optdesc_named.print(std::cout);
         return 1;
     }
@@ -199,151 +265,344 @@ int parse_args(po::variables_map& opts, int argc, char** argv) {
     return 0;
 }
 
-void extract_images(asset_offsets& offsets, Buffer& buffer, const std::string& output_dir_path, image_format format) {
-    if (offsets.images == INVALID_OFFSET) {
-        std::cerr << "failed to find image offsets";
-        return;
+// Workers of the parallel extractors report errors through this, so that lines don't get mixed up
+std::mutex log_mutex;
+
+// Size of the buffer an image is decoded into
+uint64_t image_decode_size(uint32_t width, uint32_t height) {
+    return static_cast<uint64_t>(width) * height * 4;
+}
+
+// How much of the memory budget decoding a whole image takes. chowimg grows the decode buffer if the
+// payload decodes to more than expected, which at least doubles it while the old block is still
+// allocated.
+uint64_t image_decode_cost(uint32_t width, uint32_t height) {
+    return image_decode_size(width, height) * 3;
+}
+
+// Size of the buffer `rows` whole rows of an image are decoded into when cropping to a region.
+// decode_range never goes past that, so this is also what it takes of the memory budget.
+uint64_t image_region_decode_size(uint32_t width, uint32_t rows) {
+    return image_decode_size(width, rows) + DECODE_RANGE_SCRATCH;
+}
+
+// Share of --max-memory that the scratch pools may keep between images. It's taken out of the
+// budget for decoding, so that both together stay within the limit.
+constexpr const uint64_t SCRATCH_RETAIN_SHARE = 4;
+
+// Decode buffers are reused from entry to entry through a pool per worker
+std::vector<std::unique_ptr<ScratchPool>> make_scratch_pools(unsigned jobs, uint64_t retain_limit, bool huge_pages) {
+    std::vector<std::unique_ptr<ScratchPool>> pools;
+    for (unsigned worker=0; worker<jobs; ++worker) {
+        pools.emplace_back(new ScratchPool(retain_limit, huge_pages));
     }
-    
-    // I don't know the size of the compressed data, so let's just get a 16mb buffer that should be large enough for everything
-    constexpr const int buffer_size = 0x1000000;
-    Buffer temp_buffer(buffer_size);
-
-    int entry_number = 0;
-    int extracted_number = 0;
-    for (uint32_t i=offsets.images; i<offsets.sounds; i+=4) {
-        buffer.seek(i, Buffer::SET);
-        uint32_t entry_offset = buffer.read_u32();
-        buffer.seek(entry_offset, Buffer::SET);
-        
-        uint16_t width        = buffer.read_u16();
-        uint16_t height       = buffer.read_u16();
-
-        buffer.seek(entry_offset + 12, Buffer::SET);
-        uint8_t  extra_float_count = buffer.read_u8();
-        uint32_t size_offset  = 13 + extra_float_count * 8;
-        uint32_t image_data_offset = size_offset + 4;
-
-        buffer.seek(entry_offset + size_offset, Buffer::SET);
-        uint32_t size         = buffer.read_u32();
-        uint8_t* image_data   = buffer.at(entry_offset + image_data_offset);
-
-        unsigned long out_size = buffer_size;
-        if (format == image_format::ZLIB || format == image_format::CHOWIMG) {
-            bool decompression_success = false;
-            if (format == image_format::ZLIB) {
-                int result = uncompress(temp_buffer.at(0), &out_size, image_data, size);
-                if (result != Z_OK) {
-                    std::cerr << "zlib decompression failure for image" << entry_number 
-                      << " (" << width << "x" << height << "), image_offset=0x"
-                      << std::hex << entry_offset + image_data_offset << ", entry_offset=0x" 
-                      << entry_offset << std::dec << std::endl;
-                } else {
-                    decompression_success = true;
+    return pools;
+}
+
+struct image_extract_options {
+    image_format format = image_format::AUTO;
+    const ImageCodec* codec = nullptr;  // With image_format::CODEC
+    unsigned jobs = 1;
+    bool crop = false;                  // Only decode `region` of every image
+    image_region region;
+    uint32_t thumbnail_size = 0;        // If set, images are scaled down to fit in a square this big
+    bool huge_pages = false;            // Back large decode buffers with huge pages
+    uint64_t pool_retain_limit = 0;     // How much of its freed decode buffers each worker keeps
+};
+
+// `entries` are the numbers of the images to extract, best given in file order (see
+// sort_entries_by_offset). Returns how many were written.
+uint32_t extract_images(
+  const AssetIndex& index, Buffer& buffer, int input_fd, const std::string& output_dir_path,
+  const std::vector<uint32_t>& entries, const image_extract_options& options, MemoryBudget& budget
+) {
+    std::vector<std::unique_ptr<ScratchPool>> pools = make_scratch_pools(options.jobs, options.pool_retain_limit, options.huge_pages);
+    ReadaheadWindow readahead(input_fd, buffer.get_size());
+
+    // Images big enough for write_png to split are encoded after the rest, with all the jobs.
+    // This goes by the size of the PNG, which cropping and thumbnails make smaller.
+    auto large_png = [&](uint32_t i) {
+        uint32_t entry = index.begin(SECTION_IMAGES) + entries[i];
+        image_region region = {0, 0, index.field(entry, IMAGE_WIDTH), index.field(entry, IMAGE_HEIGHT)};
+        if (options.crop) {
+            uint32_t width = region.width, height = region.height;
+            region = options.region;
+            if (!clip_image_region(region, width, height)) {
+                return false;
+            }
+        }
+        uint32_t out_width = region.width, out_height = region.height;
+        if (options.thumbnail_size) {
+            thumbnail_size(region.width, region.height, options.thumbnail_size, out_width, out_height);
+        }
+        return static_cast<uint64_t>(out_width) * out_height >= PARALLEL_PNG_MIN_PIXELS;
+    };
+
+    std::atomic<int> extracted_number(0);
+    parallel_for_large_last(options.jobs, entries.size(), large_png, [&](uint32_t i, unsigned worker, unsigned png_jobs) {
+        uint32_t entry_number = entries[i];
+        uint32_t entry = index.begin(SECTION_IMAGES) + entry_number;
+        uint32_t entry_offset = index.entry_offset[entry];
+        readahead.advance(entry_offset);
+        uint32_t image_data_offset = index.payload_offset[entry];
+        uint32_t size = index.payload_size[entry];
+        uint32_t width = index.field(entry, IMAGE_WIDTH);
+        uint32_t height = index.field(entry, IMAGE_HEIGHT);
+        uint8_t* image_data = buffer.at(image_data_offset);
+
+        const ImageCodec* entry_codec = options.codec;
+        if (options.format == image_format::AUTO) {
+            entry_codec = sniff_image_codec(image_data, size);
+            if (!entry_codec) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << "unknown image format for image" << entry_number
+                  << ", extracting raw data instead" << std::endl;
+            }
+        }
+
+        image_region region = {0, 0, width, height};
+        if (entry_codec && options.crop) {
+            region = options.region;
+            if (!clip_image_region(region, width, height)) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << "region is outside of image" << entry_number
+                  << " (" << width << "x" << height << ")" << std::endl;
+                return;
+            }
+        }
+
+        if (entry_codec) {
+            // Whole rows get decoded, cropping to the region's columns happens afterwards
+            // Thumbnails take less than the full region to encode, but it's a safe upper bound
+            uint64_t decoded_size = options.crop
+              ? image_region_decode_size(width, region.height) : image_decode_size(width, height);
+            if (decoded_size > UINT32_MAX) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << "image" << entry_number << " (" << width << "x" << height
+                  << ") is too large to decode" << std::endl;
+                return;
+            }
+            uint64_t decode_cost = options.crop ? decoded_size : image_decode_cost(width, height);
+            MemoryReservation reservation(budget, decode_cost + png_encode_memory(region.width, region.height));
+            Buffer temp_buffer(decoded_size, *pools[worker]);
+
+            // The codec moves the input offset, so each worker needs its own view
+            Buffer input_view(buffer.at(0), buffer.get_size());
+            int result = options.crop
+              ? decode_image_region(*entry_codec, temp_buffer, input_view, image_data_offset, size, width, region)
+              : entry_codec->decode(temp_buffer, input_view, image_data_offset, size);
+
+            if (result) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << entry_codec->name << " decompression failure for image" << entry_number 
+                  << " (" << width << "x" << height << "), image_offset=0x"
+                  << std::hex << image_data_offset << ", entry_offset=0x" 
+                  << entry_offset << std::dec << std::endl;
+            } else if (temp_buffer.tell() != image_decode_size(region.width, region.height)) {
+                // Less than the header says would leave the encoder reading past what was decoded
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << "image" << entry_number << " (" << width << "x" << height << ") decoded to "
+                  << temp_buffer.tell() << " bytes, expected " << image_decode_size(region.width, region.height)
+                  << std::endl;
+            } else {
+                auto filename = output_dir_path + "/image" + std::to_string(entry_number);
+                if (options.crop) {
+                    filename += "-region-" + std::to_string(region.width) + "x" + std::to_string(region.height)
+                      + "+" + std::to_string(region.x) + "+" + std::to_string(region.y);
+                }
+
+                uint32_t out_width = region.width, out_height = region.height;
+                if (options.thumbnail_size) {
+                    thumbnail_size(region.width, region.height, options.thumbnail_size, out_width, out_height);
+                    downsample_box(temp_buffer.at(0), region.width, region.height, out_width, out_height);
+                    filename += "-thumb";
                 }
-            } else if (format == image_format::CHOWIMG) {
-                temp_buffer.seek(0, Buffer::SET);
-                buffer.seek(entry_offset + image_data_offset, Buffer::SET);
-                int result = chowimg_read(temp_buffer, buffer, 
-                    entry_offset + image_data_offset + size);
-
-                if (result) {
-                    std::cerr << "chowimg decompression failure for image" << entry_number 
-                      << " (" << width << "x" << height << "), image_offset=0x"
-                      << std::hex << entry_offset + image_data_offset << ", entry_offset=0x" 
-                      << entry_offset << std::dec << std::endl;
+
+                filename += ".png";
+                if (write_png(filename, out_width, out_height, temp_buffer.at(0), png_jobs)) {
+                    std::lock_guard<std::mutex> lock(log_mutex);
+                    std::cerr << "failed to write " << filename << std::endl;
                 } else {
-                    decompression_success = true;
+                    ++extracted_number;
                 }
             }
-            if (decompression_success) {
-                auto filename = output_dir_path + "/image" + std::to_string(entry_number) + ".png";
-                stbi_write_png(filename.c_str(), width, height, 4, temp_buffer.at(0), width * 4);
-                ++extracted_number;
-            }
-        } else if (format == image_format::RAW) {
+        } else {
             auto filename = output_dir_path + "/image" + std::to_string(entry_number) + "-" 
               + std::to_string(width) + "x" + std::to_string(height) + ".bin";
-            FILE* out = fopen(filename.c_str(), "wb");
-            fwrite(image_data, size, 1, out);
-            fclose(out);
-            ++extracted_number;
+            if (write_file_range(filename, input_fd, image_data_offset, image_data, size)) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << "failed to write " << filename << std::endl;
+            } else {
+                ++extracted_number;
+            }
         }
-        ++entry_number;
-    };
+    });
     std::cout << "Wrote " << extracted_number << " images" << std::endl;
+    return extracted_number;
 }
 
-void extract_audio(
-  asset_offsets& offsets, Buffer& buffer, 
-  const std::string& output_dir_path, sound_format format
+// Besides writing the files, adds the duration, channels and so on of every file written to
+// `audio_index`, read from the container headers so that nothing has to open the files again.
+uint32_t extract_audio(
+  const AssetIndex& index, Buffer& buffer, int input_fd,
+  const std::string& output_dir_path, const std::vector<uint32_t>& entries,
+  std::vector<audio_index_entry>& audio_index
 ) {
-    if (offsets.sounds == INVALID_OFFSET) {
-        std::cerr << "failed to find sound offsets";
-        return;
-    }
+    ReadaheadWindow readahead(input_fd, buffer.get_size());
+    uint32_t written = 0;
+    for (uint32_t entry_number : entries) {
+        uint32_t entry = index.begin(SECTION_SOUNDS) + entry_number;
+        readahead.advance(index.entry_offset[entry]);
+        uint32_t audio_type = index.field(entry, SOUND_TYPE);
 
-    const sound_offsets& sound_offsets = get_sound_offsets(format);
+        if (audio_type == 0) {
+            std::cerr << "Invalid audio type at 0x" << std::hex << index.entry_offset[entry] << std::dec << std::endl;
+        } else {
+            auto& extension = audio_type == 1 ? extension_wav : extension_ogg;
+            auto basename = "audio" + std::to_string(entry_number) + extension;
+            auto filename = output_dir_path + "/" + basename;
+
+            uint32_t data_offset = index.payload_offset[entry];
+            uint32_t size = index.payload_size[entry];
+            if (write_file_range(filename, input_fd, data_offset, buffer.at(data_offset), size)) {
+                std::cerr << "failed to write " << filename << std::endl;
+                continue;
+            }
+            ++written;
 
-    int entry_number = 0;
-    for (uint32_t i=offsets.sounds; i<offsets.fonts; i+=4) {
-        buffer.seek(i, Buffer::SET);
-        uint32_t entry_offset = buffer.read_u32();
+            audio_index_entry index_entry = {entry_number, basename, size, false, audio_info()};
+            index_entry.parsed = read_audio_info(audio_type, buffer.at(data_offset), size, index_entry.info);
+            if (!index_entry.parsed) {
+                std::cerr << "couldn't read the " << extension << " headers of " << basename << std::endl;
+            }
+            audio_index.push_back(index_entry);
+        }
+    }
+    std::cout << "Wrote " << written << " audio files" << std::endl;
+    return written;
+}
+
+uint32_t extract_shaders(
+  const AssetIndex& index, Buffer& buffer, int input_fd,
+  const std::string& output_dir_path, const std::vector<uint32_t>& entries
+) {
+    ReadaheadWindow readahead(input_fd, buffer.get_size());
+    uint32_t written = 0;
+    for (uint32_t entry_number : entries) {
+        uint32_t entry = index.begin(SECTION_SHADERS) + entry_number;
+        readahead.advance(index.entry_offset[entry]);
+        uint32_t offset_vert = index.payload_offset[entry];
+        auto filename_vert = output_dir_path + "/shader" + std::to_string(entry_number) + ".vert";
 
-        buffer.seek(entry_offset, Buffer::SET);
-        uint32_t audio_type = buffer.read_u32();
+        if (write_file_range(filename_vert, input_fd, offset_vert, buffer.at(offset_vert), index.payload_size[entry])) {
+            std::cerr << "failed to write " << filename_vert << std::endl;
+            continue;
+        }
 
-        buffer.seek(entry_offset + sound_offsets.size, Buffer::SET);
-        uint32_t size = buffer.read_u32();
+        uint32_t offset_frag = index.field(entry, SHADER_FRAG_OFFSET);
+        auto filename_frag = output_dir_path + "/shader" + std::to_string(entry_number) + ".frag";
 
-        if (audio_type == 0) {
-            std::cerr << "Invalid audio type at 0x" << std::hex << entry_offset << std::endl;
+        if (write_file_range(filename_frag, input_fd, offset_frag, buffer.at(offset_frag), index.field(entry, SHADER_FRAG_SIZE))) {
+            std::cerr << "failed to write " << filename_frag << std::endl;
         } else {
-            auto& extension = audio_type == 1 ? extension_wav : extension_ogg;
-            auto filename = output_dir_path + "/audio" + std::to_string(entry_number) + extension;
-    
-            FILE* out = std::fopen(filename.c_str(), "wb");
-            fwrite(buffer.at(entry_offset + sound_offsets.data), size, 1, out);
-            fclose(out);
+            ++written;
         }
-        ++entry_number;
     }
-    std::cout << "Wrote " << entry_number << " audio files" << std::endl;
+    std::cout << "Wrote " << written << " shader pairs" << std::endl;
+    return written;
 }
 
-void extract_shaders(asset_offsets& offsets, Buffer& buffer, const std::string& output_dir_path) {
-    if (offsets.shaders == INVALID_OFFSET) {
-        std::cerr << "failed to find shader offsets";
-        return;
+// The format of fonts, files and platform entries is unknown, so they're extracted as-is
+uint32_t extract_blobs(
+  const AssetIndex& index, asset_section section, Buffer& buffer, int input_fd,
+  const std::string& output_dir_path, const std::vector<uint32_t>& entries, const std::string& name
+) {
+    ReadaheadWindow readahead(input_fd, buffer.get_size());
+    uint32_t written = 0;
+    for (uint32_t entry_number : entries) {
+        uint32_t entry = index.begin(section) + entry_number;
+        readahead.advance(index.entry_offset[entry]);
+        auto filename = output_dir_path + "/" + name + std::to_string(entry_number) + ".bin";
+
+        uint32_t data_offset = index.payload_offset[entry];
+        if (write_file_range(filename, input_fd, data_offset, buffer.at(data_offset), index.payload_size[entry])) {
+            std::cerr << "failed to write " << filename << std::endl;
+        } else {
+            ++written;
+        }
     }
-    
-    int entry_number = 0;
-    for (uint32_t i=offsets.shaders; i<offsets.files; i+=4) {
-        buffer.seek(i, Buffer::SET);
-        uint32_t entry_offset_vert = buffer.read_u32();
-
-        buffer.seek(entry_offset_vert, Buffer::SET);
-        uint32_t size_vert = buffer.read_u32();
-    
-        auto filename_vert = output_dir_path + "/shader" + std::to_string(entry_number) + ".vert";
-
-        FILE* vert = std::fopen(filename_vert.c_str(), "w");
-        fwrite(buffer.at(entry_offset_vert + 4), size_vert, 1, vert);
-        fclose(vert);
+    std::cout << "Wrote " << written << " " << asset_section_names[section] << " entries" << std::endl;
+    return written;
+}
 
-        uint32_t entry_offset_frag = entry_offset_vert + 4 + size_vert;
-        buffer.seek(entry_offset_frag, Buffer::SET);
-        uint32_t size_frag = buffer.read_u32();
+// Prints every entry's header fields without touching the payloads
+void list_entries(const AssetIndex& index, std::ostream& out, bool json) {
+    if (json) out << "{" << std::endl;
+    for (int section_id=0; section_id<SECTION_COUNT; ++section_id) {
+        asset_section section = static_cast<asset_section>(section_id);
+        if (json) {
+            out << "  \"" << asset_section_names[section] << "\": [";
+        } else {
+            out << asset_section_names[section] << " (" << index.count(section) << " entries)" << std::endl;
+        }
 
-        auto filename_frag = output_dir_path + "/shader" + std::to_string(entry_number) + ".frag";
+        for (uint32_t entry=index.begin(section); entry<index.end(section); ++entry) {
+            uint32_t entry_number = entry - index.begin(section);
+            if (json) {
+                out << (entry_number ? "," : "") << std::endl << "    {\"index\": " << entry_number
+                  << ", \"offset\": " << index.entry_offset[entry]
+                  << ", \"payload_offset\": " << index.payload_offset[entry]
+                  << ", \"size\": " << index.payload_size[entry];
+            } else {
+                out << "  " << entry_number << ": offset=0x" << std::hex << index.entry_offset[entry]
+                  << " payload_offset=0x" << index.payload_offset[entry] << std::dec
+                  << " size=" << index.payload_size[entry];
+            }
 
-        FILE* frag = std::fopen(filename_frag.c_str(), "w");
-        fwrite(buffer.at(entry_offset_frag + 4), size_frag, 1, frag);
-        fclose(frag);
+            switch (section) {
+                case SECTION_IMAGES:
+                    if (json) {
+                        out << ", \"width\": " << index.field(entry, IMAGE_WIDTH)
+                          << ", \"height\": " << index.field(entry, IMAGE_HEIGHT)
+                          << ", \"extra_float_count\": " << index.field(entry, IMAGE_EXTRA_FLOAT_COUNT);
+                    } else {
+                        out << " " << index.field(entry, IMAGE_WIDTH) << "x" << index.field(entry, IMAGE_HEIGHT)
+                          << " extra_float_count=" << index.field(entry, IMAGE_EXTRA_FLOAT_COUNT);
+                    }
+                    break;
+                case SECTION_SOUNDS:
+                    if (json) {
+                        out << ", \"audio_type\": " << index.field(entry, SOUND_TYPE)
+                          << ", \"sample_rate\": " << index.field(entry, SOUND_SAMPLE_RATE)
+                          << ", \"unknown1\": " << index.field(entry, SOUND_UNKNOWN1)
+                          << ", \"unknown3\": " << index.field(entry, SOUND_UNKNOWN3);
+                    } else {
+                        out << " audio_type=" << index.field(entry, SOUND_TYPE)
+                          << " sample_rate=" << index.field(entry, SOUND_SAMPLE_RATE)
+                          << " unknown1=" << index.field(entry, SOUND_UNKNOWN1)
+                          << " unknown3=" << index.field(entry, SOUND_UNKNOWN3);
+                    }
+                    break;
+                case SECTION_SHADERS:
+                    if (json) {
+                        out << ", \"fragment_offset\": " << index.field(entry, SHADER_FRAG_OFFSET)
+                          << ", \"fragment_size\": " << index.field(entry, SHADER_FRAG_SIZE);
+                    } else {
+                        out << " fragment_offset=0x" << std::hex << index.field(entry, SHADER_FRAG_OFFSET)
+                          << std::dec << " fragment_size=" << index.field(entry, SHADER_FRAG_SIZE);
+                    }
+                    break;
+                default:
+                    break;
+            }
+            out << (json ? "}" : "\n");
+        }
 
-        ++entry_number;
+        if (json) {
+            out << (index.count(section) ? "\n  " : "") << "]" << (section_id + 1 < SECTION_COUNT ? "," : "") << std::endl;
+        }
     }
-    std::cout << "Wrote " << entry_number << " shader pairs" << std::endl;
+    if (json) out << "}" << std::endl;
 }
 
 uint32_t find_shader_code_offset(uint8_t* mmap, uint32_t file_size) {
@@ -507,13 +766,47 @@ uint32_t find_type_sizes_fallback_method(uint8_t* mmap, uint32_t file_size) {
     return first_offset - 24;
 }
 
+// Walks the shader entries that a candidate type_sizes says are there. If they add up to exactly
+// the size it claims, it is almost certainly the real type_sizes.
+bool validate_type_sizes(uint8_t* mmap, uint32_t file_size, uint32_t type_sizes_offset) {
+    if (type_sizes_offset == INVALID_OFFSET || file_size < 24 || type_sizes_offset > file_size - 24) {
+        return false;
+    }
+
+    uint32_t size_shaders   = read_little_endian_u32(mmap + type_sizes_offset + 12);
+    uint32_t size_files     = read_little_endian_u32(mmap + type_sizes_offset + 16);
+    uint32_t size_platform  = read_little_endian_u32(mmap + type_sizes_offset + 20);
+    uint64_t size_after_shaders = static_cast<uint64_t>(size_shaders) + size_files + size_platform;
+    if (size_shaders == 0 || size_after_shaders > file_size) {
+        return false;
+    }
+
+    uint32_t shaders_start = file_size - size_after_shaders;
+    uint32_t shaders_end = shaders_start + size_shaders;
+    uint32_t curr_offset = shaders_start;
+    while (curr_offset < shaders_end) {
+        curr_offset = shader_seek_forwards(mmap, curr_offset, file_size);
+        if (curr_offset == INVALID_OFFSET) {
+            return false;
+        }
+    }
+    return curr_offset == shaders_end;
+}
+
 uint32_t find_asset_offsets(asset_offsets& offsets, Buffer& buffer) {
     // For these operations in particular, I think working with
     // the raw uint8_t* makes things more convenient.
     uint8_t* mmap = buffer.at(0);
     uint32_t file_size = buffer.get_size();
 
-    uint32_t type_sizes_offset = find_type_sizes_shader_method(mmap, file_size);
+    // The fallback method only looks at the start of the file, so try it first and confirm it found
+    // the right thing by walking the shaders it points at. Scanning for shader code byte by byte
+    // reads through all the images and sounds first, since the shaders are near the end, which
+    // takes a while on multi-GB archives and would make --list and --diff as slow as extracting.
+    uint32_t type_sizes_offset = find_type_sizes_fallback_method(mmap, file_size);
+    if (!validate_type_sizes(mmap, file_size, type_sizes_offset)) {
+        type_sizes_offset = find_type_sizes_shader_method(mmap, file_size);
+    }
     if (type_sizes_offset == INVALID_OFFSET) {
         std::cerr << "Warning: failed to locate type_sizes using the primary method, " 
             "potentially incorrect fallback will be used!" << std::endl;
@@ -556,66 +849,406 @@ uint32_t find_asset_offsets(asset_offsets& offsets, Buffer& buffer) {
     return 0;
 }
 
-int main(int argc, char **argv) {
-    po::variables_map opts;
-    if (parse_args(opts, argc, argv)) {
-        return 1;
+struct verify_result {
+    std::atomic<uint32_t> passed;
+    std::atomic<uint32_t> failed;
+    std::atomic<uint64_t> bytes;
+};
+
+// Returns nullptr if the entry is fine, otherwise why it isn't
+const char* verify_entry(
+  const AssetIndex& index, asset_section section, uint32_t entry, Buffer& buffer,
+  const image_extract_options& options, ScratchPool& pool, MemoryBudget& budget
+) {
+    uint32_t payload_offset = index.payload_offset[entry];
+    uint32_t size = index.payload_size[entry];
+    const uint8_t* payload = buffer.at(payload_offset);
+
+    if (section == SECTION_IMAGES) {
+        const ImageCodec* codec = options.format == image_format::CODEC 
+          ? options.codec : sniff_image_codec(payload, size);
+        if (!codec) {
+            return "unknown image format";
+        }
+
+        uint32_t width = index.field(entry, IMAGE_WIDTH), height = index.field(entry, IMAGE_HEIGHT);
+        uint64_t decoded_size = image_decode_size(width, height);
+        if (decoded_size > UINT32_MAX) {
+            return "image is too large to decode";
+        }
+        MemoryReservation reservation(budget, image_decode_cost(width, height));
+        Buffer temp_buffer(decoded_size, pool);
+        Buffer input_view(buffer.at(0), buffer.get_size());
+        if (codec->decode(temp_buffer, input_view, payload_offset, size)) {
+            return "decompression failure";
+        }
+        if (temp_buffer.tell() != decoded_size) {
+            return "decompressed size doesn't match width*height*4";
+        }
+    } else if (section == SECTION_SOUNDS) {
+        uint32_t audio_type = index.field(entry, SOUND_TYPE);
+        const char* magic = audio_type == 1 ? "RIFF" : audio_type == 2 ? "OggS" : nullptr;
+        if (!magic) {
+            return "invalid audio type";
+        }
+        if (size < 4 || std::memcmp(payload, magic, 4) != 0) {
+            return audio_type == 1 ? "WAV data doesn't start with RIFF" : "Ogg data doesn't start with OggS";
+        }
+    } else if (section == SECTION_SHADERS) {
+        const uint8_t* frag = buffer.at(index.field(entry, SHADER_FRAG_OFFSET));
+        uint32_t frag_size = index.field(entry, SHADER_FRAG_SIZE);
+        if (!std::all_of(payload, payload + size, is_valid_glsl) || !std::all_of(frag, frag + frag_size, is_valid_glsl)) {
+            return "shader contains characters that can't be GLSL";
+        }
     }
+    return nullptr;
+}
 
-    auto& input_file_path = opts["input"].as<std::string>();
-    auto& output_dir_path = opts["output"].as<std::string>();
-    
-    if (!fs::is_regular_file(input_file_path)) {
-        std::cerr << input_file_path << ": not a regular file" << std::endl;
+// Decodes and checks everything like an extraction would, minus the writing. Returns 1 if anything failed.
+int verify_archive(
+  const AssetIndex& index, Buffer& buffer, const std::vector<asset_section>& sections,
+  const image_extract_options& options, MemoryBudget& budget
+) {
+    std::vector<std::unique_ptr<ScratchPool>> pools = make_scratch_pools(options.jobs, options.pool_retain_limit, options.huge_pages);
+
+    bool any_failed = false;
+    std::cout << std::fixed << std::setprecision(2);
+    for (asset_section section : sections) {
+        verify_result result = {{0}, {0}, {0}};
+        auto start_time = std::chrono::steady_clock::now();
+
+        parallel_for(options.jobs, index.count(section), [&](uint32_t entry_number, unsigned worker) {
+            uint32_t entry = index.begin(section) + entry_number;
+            const char* error = verify_entry(index, section, entry, buffer, options, *pools[worker], budget);
+            if (error) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << asset_section_names[section] << " entry " << entry_number 
+                  << " (entry_offset=0x" << std::hex << index.entry_offset[entry] << std::dec << "): " 
+                  << error << std::endl;
+                ++result.failed;
+            } else {
+                ++result.passed;
+            }
+            result.bytes += index.payload_size[entry] 
+              + (section == SECTION_SHADERS ? index.field(entry, SHADER_FRAG_SIZE) : 0);
+        });
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        double megabytes = result.bytes / (1024.0 * 1024.0);
+        std::cout << asset_section_names[section] << ": " << result.passed << " passed, " 
+          << result.failed << " failed, " << megabytes << " MiB in " << elapsed.count() << "s ("
+          << (elapsed.count() > 0 ? megabytes / elapsed.count() : 0) << " MiB/s)" << std::endl;
+        any_failed |= result.failed > 0;
+    }
+    return any_failed ? 1 : 0;
+}
+
+// An input file, mapped and probed
+struct Archive {
+    std::unique_ptr<FILE, int(*)(FILE*)> file;
+    std::unique_ptr<Buffer> buffer;
+    int fd = -1;
+    asset_offsets offsets;
+    AssetIndex index;
+
+    Archive() : file(nullptr, std::fclose) {}
+};
+
+int open_archive(Archive& archive, const std::string& path) {
+    if (!fs::is_regular_file(path)) {
+        std::cerr << path << ": not a regular file" << std::endl;
         return 1;
     }
-    if (!fs::is_directory(output_dir_path)) {
-        std::cerr << output_dir_path << ": directory does not exist" << std::endl;
+
+    archive.file.reset(std::fopen(path.c_str(), "rb"));
+    if (!archive.file) {
+        std::cerr << path << ": failed to open" << std::endl;
         return 1;
     }
 
-    FILE* file = std::fopen(input_file_path.c_str(), "rb");
+    // Mapped rather than read, so that the archive itself doesn't count towards memory use
+    archive.buffer.reset(new Buffer(archive.file.get(), Buffer::MAPPED));
 
-    Buffer input_buffer(file);
-    
-    std::fclose(file);
+    // The file stays open so that passthrough payloads (raw images, audio, shaders)
+    // can be copied straight from it by the kernel instead of through the buffer.
+#ifdef __linux__
+    archive.fd = fileno(archive.file.get());
+#endif
 
-    asset_offsets offsets;
-    if (find_asset_offsets(offsets, input_buffer)) {
-        std::cerr << "failed to find asset_offsets" << std::endl;
+    if (find_asset_offsets(archive.offsets, *archive.buffer)) {
+        std::cerr << path << ": failed to find asset_offsets" << std::endl;
         return 1;
     }
+    return 0;
+}
 
-    std::cout 
+void print_offsets(const asset_offsets& offsets, std::ostream& out) {
+    out 
       << "Determined following offsets:" << std::endl << std::hex
       << "  - images:     0x" << offsets.images << std::endl
       << "  - sounds:     0x" << offsets.sounds << std::endl
       << "  - fonts:      0x" << offsets.fonts << std::endl
+      << "  - shaders:    0x" << offsets.shaders << std::endl
       << "  - files:      0x" << offsets.files << std::endl
       << "  - platform:   0x" << offsets.platform << std::endl
       << "  - type_sizes: 0x" << offsets.sizes << std::endl << std::dec;
+}
+
+std::vector<uint32_t> all_entries(const AssetIndex& index, asset_section section) {
+    std::vector<uint32_t> entries(index.count(section));
+    for (uint32_t i=0; i<entries.size(); ++i) entries[i] = i;
+    return entries;
+}
+
+// Compares entries with the same number in both archives, header and payload. Fills `updated`
+// with the numbers of entries in new_archive that are new or different, per section.
+void diff_archives(
+  const Archive& old_archive, const Archive& new_archive, unsigned jobs,
+  std::vector<uint32_t> (&updated)[SECTION_COUNT]
+) {
+    const AssetIndex& old_index = old_archive.index;
+    const AssetIndex& new_index = new_archive.index;
+
+    for (int section_id=0; section_id<SECTION_COUNT; ++section_id) {
+        asset_section section = static_cast<asset_section>(section_id);
+        uint32_t old_count = old_index.count(section);
+        uint32_t new_count = new_index.count(section);
+        uint32_t common_count = std::min(old_count, new_count);
+
+        // Entries are compared directly rather than through hashes: both sides are mapped anyway,
+        // so this reads the same bytes a hash would, stops at the first difference and can't collide.
+        std::vector<uint8_t> changed(common_count);
+        parallel_for(jobs, common_count, [&](uint32_t entry_number, unsigned) {
+            uint32_t old_entry = old_index.begin(section) + entry_number;
+            uint32_t new_entry = new_index.begin(section) + entry_number;
+            uint32_t old_size = old_index.entry_end(section, old_entry) - old_index.entry_offset[old_entry];
+            uint32_t new_size = new_index.entry_end(section, new_entry) - new_index.entry_offset[new_entry];
+            changed[entry_number] = old_size != new_size || std::memcmp(
+                old_archive.buffer->at(old_index.entry_offset[old_entry]),
+                new_archive.buffer->at(new_index.entry_offset[new_entry]), new_size) != 0;
+        });
+
+        uint32_t changed_count = std::count(changed.begin(), changed.end(), 1);
+        uint32_t added_count = new_count - common_count;
+        uint32_t removed_count = old_count - common_count;
+        std::cout << asset_section_names[section] << ": " << changed_count << " changed, " 
+          << added_count << " added, " << removed_count << " removed" << std::endl;
+
+        for (uint32_t i=0; i<common_count; ++i) {
+            if (changed[i]) {
+                std::cout << "  changed " << i << std::endl;
+                updated[section].push_back(i);
+            }
+        }
+        for (uint32_t i=common_count; i<new_count; ++i) {
+            std::cout << "  added " << i << std::endl;
+            updated[section].push_back(i);
+        }
+        for (uint32_t i=common_count; i<old_count; ++i) {
+            std::cout << "  removed " << i << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    po::variables_map opts;
+    if (parse_args(opts, argc, argv)) {
+        return 1;
+    }
+
+    if (opts.count("merge-shards")) {
+        return merge_shard_summaries(opts["merge-shards"].as<std::string>(), std::cout);
+    }
+
+    auto& input_file_path = opts["input"].as<std::string>();
+    std::string output_dir_path = opts.count("output") ? opts["output"].as<std::string>() : "";
+    bool list = opts.count("list");
+    bool diff = opts.count("diff");
+    
+    if (!output_dir_path.empty() && !fs::is_directory(output_dir_path)) {
+        std::cerr << output_dir_path << ": directory does not exist" << std::endl;
+        return 1;
+    }
+
+    Archive archive;
+    if (open_archive(archive, input_file_path)) {
+        return 1;
+    }
+
+    // With --list, stdout is reserved for the listing (which might be JSON),
+    // and with --diff for the differences
+    print_offsets(archive.offsets, (list || diff) ? std::cerr : std::cout);
 
     if (opts.count("probe-offsets")) {
         return 0;
     }
 
+    sound_format sound_format = get_sound_format(opts["sound-format"].as<std::string>());
+    if (sound_format == sound_format::INVALID) {
+        std::cerr << "passed invalid sound-format" << std::endl;
+        return 1;
+    }
+
+    AssetIndex& index = archive.index;
+    Buffer& input_buffer = *archive.buffer;
+    int input_fd = archive.fd;
+    if (build_asset_index(index, archive.offsets, input_buffer, sound_format)) {
+        std::cerr << "failed to index the archive, perhaps try another sound-format?" << std::endl;
+        return 1;
+    }
+
+    if (list) {
+        list_entries(index, std::cout, opts.count("json"));
+        return 0;
+    }
+
+    unsigned jobs = opts["jobs"].as<unsigned>();
+    if (jobs == 0) {
+        jobs = default_job_count();
+    }
+    uint64_t max_memory = opts["max-memory"].as<uint64_t>() << 20;
+    uint64_t retained_memory = max_memory / SCRATCH_RETAIN_SHARE;
+    MemoryBudget budget(max_memory - retained_memory);
+
+    image_extract_options options;
+    options.format = get_image_format(opts["image-format"].as<std::string>(), options.codec);
+    options.jobs = jobs;
+    options.huge_pages = opts.count("huge-pages");
+    options.pool_retain_limit = max_memory ? retained_memory / jobs : DEFAULT_SCRATCH_RETAIN_LIMIT;
+
+    if (opts.count("verify")) {
+        std::vector<asset_section> sections;
+        if (!opts.count("no-images")) sections.push_back(SECTION_IMAGES);
+        if (!opts.count("no-audio")) sections.push_back(SECTION_SOUNDS);
+        if (!opts.count("no-shaders")) sections.push_back(SECTION_SHADERS);
+        return verify_archive(index, input_buffer, sections, options, budget);
+    }
+
+    shard_spec shard = {1, 1};
+    if (opts.count("shard") && !parse_shard_spec(opts["shard"].as<std::string>(), shard)) {
+        std::cerr << "passed invalid shard, expected K/N with K from 1 to N" << std::endl;
+        return 1;
+    }
+
+    if (opts.count("thumbnails") && opts["thumbnails"].as<uint32_t>() == 0) {
+        std::cerr << "passed invalid thumbnail size, expected at least 1" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint32_t> entries[SECTION_COUNT];
+    if (diff) {
+        Archive old_archive;
+        if (open_archive(old_archive, opts["diff"].as<std::string>())) {
+            return 1;
+        }
+        if (build_asset_index(old_archive.index, old_archive.offsets, *old_archive.buffer, sound_format)) {
+            std::cerr << "failed to index the old archive, perhaps try another sound-format?" << std::endl;
+            return 1;
+        }
+        diff_archives(old_archive, archive, jobs, entries);
+
+        // Without an output directory, the list of differences is all that's wanted
+        if (output_dir_path.empty()) {
+            return 0;
+        }
+    } else {
+        for (int section=0; section<SECTION_COUNT; ++section) {
+            entries[section] = all_entries(index, static_cast<asset_section>(section));
+        }
+    }
+
+    if (opts.count("image")) {
+        uint32_t entry_number = opts["image"].as<uint32_t>();
+        entries[SECTION_IMAGES].clear();
+        if (entry_number < index.count(SECTION_IMAGES)) {
+            entries[SECTION_IMAGES].push_back(entry_number);
+        } else {
+            std::cerr << "there is no image" << entry_number << std::endl;
+        }
+    }
+
+    shard_summary summary;
+    summary.shard = shard;
+    summary.archive_size = input_buffer.get_size();
+    if (opts.count("shard")) {
+        shard_entries(index, entries, shard);
+
+        const char* const skip_options[SECTION_COUNT] = {
+            "no-images", "no-audio", "no-fonts", "no-shaders", "no-files", "no-platform"
+        };
+        for (int section_id=0; section_id<SECTION_COUNT; ++section_id) {
+            asset_section section = static_cast<asset_section>(section_id);
+            if (opts.count(skip_options[section])) {
+                continue;
+            }
+            summary.entries[section] = entries[section].size();
+            for (uint32_t entry_number : entries[section]) {
+                uint32_t entry = index.begin(section) + entry_number;
+                summary.bytes[section] += index.entry_end(section, entry) - index.entry_offset[entry];
+            }
+        }
+    }
+
+    // Entries are extracted in file order rather than table order, see sort_entries_by_offset
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        sort_entries_by_offset(index, static_cast<asset_section>(section), entries[section]);
+    }
+
     if (!opts.count("no-images")) {
-        image_format format = get_image_format(opts["image-format"].as<std::string>());
-        if (format != image_format::INVALID) {
-            extract_images(offsets, input_buffer, output_dir_path, format);
+        if (opts.count("thumbnails")) {
+            options.thumbnail_size = opts["thumbnails"].as<uint32_t>();
+            // Previews are small and thrown away often, spending time on compressing them isn't worth it
+            stbi_write_png_compression_level = 1;
+        }
+
+        if (opts.count("region")) {
+            options.crop = parse_image_region(opts["region"].as<std::string>(), options.region);
+            if (!options.crop) {
+                std::cerr << "passed invalid region, extracting whole images" << std::endl;
+            }
+        }
+
+        if (options.format != image_format::INVALID) {
+            summary.written[SECTION_IMAGES] = extract_images(
+              index, input_buffer, input_fd, output_dir_path, entries[SECTION_IMAGES], options, budget);
         } else {
             std::cerr << "passed invalid image-format, not extracing images" << std::endl;
         }
     }
     
+    // Entries that fail to extract are only reported, but a missing audio index fails the run
+    int result = 0;
     if (!opts.count("no-audio")) {
-        sound_format format = get_sound_format(opts["sound-format"].as<std::string>());
-        extract_audio(offsets, input_buffer, output_dir_path, format);
+        std::vector<audio_index_entry> audio_index;
+        summary.written[SECTION_SOUNDS] = extract_audio(
+          index, input_buffer, input_fd, output_dir_path, entries[SECTION_SOUNDS], audio_index);
+        std::string index_filename = opts.count("shard") ? shard_audio_index_filename(shard) : AUDIO_INDEX_FILENAME;
+        result = write_audio_index(output_dir_path + "/" + index_filename, audio_index);
     }
 
     if (!opts.count("no-shaders")) {
-        extract_shaders(offsets, input_buffer, output_dir_path);    
+        summary.written[SECTION_SHADERS] = extract_shaders(
+          index, input_buffer, input_fd, output_dir_path, entries[SECTION_SHADERS]);
     }
 
-    return 0;
+    if (!opts.count("no-fonts")) {
+        summary.written[SECTION_FONTS] = extract_blobs(
+          index, SECTION_FONTS, input_buffer, input_fd, output_dir_path, entries[SECTION_FONTS], "font");
+    }
+
+    if (!opts.count("no-files")) {
+        summary.written[SECTION_FILES] = extract_blobs(
+          index, SECTION_FILES, input_buffer, input_fd, output_dir_path, entries[SECTION_FILES], "file");
+    }
+
+    if (!opts.count("no-platform")) {
+        summary.written[SECTION_PLATFORM] = extract_blobs(
+          index, SECTION_PLATFORM, input_buffer, input_fd, output_dir_path, entries[SECTION_PLATFORM], "platform");
+    }
+
+    if (opts.count("shard") && write_shard_summary(output_dir_path, summary)) {
+        return 1;
+    }
+
+    return result;
 }
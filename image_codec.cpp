@@ -0,0 +1,161 @@
+#include "image_codec.hpp"
+#include "chowimg.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <zlib.h>
+
+static bool zlib_sniff(const uint8_t* data, uint32_t size) {
+    // CMF byte: compression method 8 (deflate) with a window of at most 32k,
+    // and the FCHECK bits make CMF*256 + FLG a multiple of 31 (RFC 1950)
+    return size >= 2 && (data[0] & 0x0f) == 8 && (data[0] >> 4) <= 7 
+      && ((data[0] << 8) | data[1]) % 31 == 0;
+}
+
+static int zlib_decode(Buffer& out, Buffer& input, uint32_t offset, uint32_t size) {
+    unsigned long out_size = out.get_size() - out.tell();
+    int result = uncompress(out.at(out.tell()), &out_size, input.at(offset), size);
+    if (result != Z_OK) {
+        return 1;
+    }
+    out.seek(out_size, Buffer::CURR);
+    return 0;
+}
+
+static int zlib_decode_range(Buffer& out, Buffer& input, uint32_t offset, uint32_t size, uint32_t start, uint32_t end) {
+    z_stream stream = {};
+    stream.next_in = input.at(offset);
+    stream.avail_in = size;
+    if (inflateInit(&stream) != Z_OK) {
+        return 1;
+    }
+
+    // Deflate streams can't be entered in the middle, so everything before the range still has to
+    // be inflated, but it goes into a small scratch buffer that's thrown away.
+    uint8_t discard[0x10000];
+    int result = Z_OK;
+    while (result == Z_OK && stream.total_out < start) {
+        stream.next_out = discard;
+        stream.avail_out = std::min<uint32_t>(sizeof(discard), start - stream.total_out);
+        result = inflate(&stream, Z_NO_FLUSH);
+    }
+
+    // ...and everything after it isn't inflated at all
+    stream.next_out = out.at(out.tell());
+    stream.avail_out = end - start;
+    while (result == Z_OK && stream.avail_out) {
+        result = inflate(&stream, Z_NO_FLUSH);
+    }
+    bool success = stream.avail_out == 0 && (result == Z_OK || result == Z_STREAM_END);
+    inflateEnd(&stream);
+    if (!success) {
+        return 1;
+    }
+    out.seek(end - start, Buffer::CURR);
+    return 0;
+}
+
+static bool chowimg_sniff(const uint8_t* data, uint32_t size) {
+    // The payload is a sequence of hunks, each prefixed with its compressed size,
+    // which should add up to exactly the payload size.
+    uint32_t offset = 0;
+    while (size - offset >= 4) {
+        uint32_t hunk_size = read_little_endian_u32(data + offset);
+        if (hunk_size == 0 || hunk_size > size - offset - 4) {
+            return false;
+        }
+        offset += 4 + hunk_size;
+    }
+    return size > 0 && offset == size;
+}
+
+static int chowimg_decode(Buffer& out, Buffer& input, uint32_t offset, uint32_t size) {
+    input.seek(offset, Buffer::SET);
+    try {
+        return chowimg_read(out, input, offset + size);
+    } catch (std::range_error&) {
+        return 1;
+    }
+}
+
+static_assert(CHOWIMG_SKIP_SCRATCH <= DECODE_RANGE_SCRATCH, "chowimg needs more scratch space for ranges");
+
+static int chowimg_decode_range(Buffer& out, Buffer& input, uint32_t offset, uint32_t size, uint32_t start, uint32_t end) {
+    input.seek(offset, Buffer::SET);
+    try {
+        return chowimg_read_range(out, input, offset + size, start, end);
+    } catch (std::range_error&) {
+        return 1;
+    }
+}
+
+// A deque, so that registering a codec doesn't move the ones that find_image_codec
+// and sniff_image_codec already handed out pointers to
+static std::deque<ImageCodec>& image_codecs() {
+    // chowimg goes first: walking the hunk sizes is a much stronger check than
+    // zlib's 2 header bytes, which a chowimg payload can pass by accident.
+    static std::deque<ImageCodec> codecs = {
+        {"chowimg", chowimg_sniff, chowimg_decode, chowimg_decode_range},
+        {"zlib", zlib_sniff, zlib_decode, zlib_decode_range}
+    };
+    return codecs;
+}
+
+void register_image_codec(const ImageCodec& codec) {
+    image_codecs().push_back(codec);
+}
+
+const ImageCodec* find_image_codec(const std::string& name) {
+    for (const ImageCodec& codec : image_codecs()) {
+        if (name == codec.name) return &codec;
+    }
+    return nullptr;
+}
+
+const ImageCodec* sniff_image_codec(const uint8_t* data, uint32_t size) {
+    for (const ImageCodec& codec : image_codecs()) {
+        if (codec.sniff(data, size)) return &codec;
+    }
+    return nullptr;
+}
+
+bool parse_image_region(const std::string& geometry, image_region& region) {
+    char trailing;
+    return std::sscanf(geometry.c_str(), "%ux%u+%u+%u%c", 
+      &region.width, &region.height, &region.x, &region.y, &trailing) == 4;
+}
+
+bool clip_image_region(image_region& region, uint32_t image_width, uint32_t image_height) {
+    if (region.x >= image_width || region.y >= image_height) {
+        return false;
+    }
+    region.width = std::min(region.width, image_width - region.x);
+    region.height = std::min(region.height, image_height - region.y);
+    return region.width && region.height;
+}
+
+int decode_image_region(
+  const ImageCodec& codec, Buffer& out, Buffer& input, uint32_t offset, uint32_t size,
+  uint32_t image_width, const image_region& region
+) {
+    uint32_t stride = image_width * 4;
+    uint32_t start = region.y * stride;
+    uint32_t end = start + region.height * stride;
+    out.seek(0, Buffer::SET);
+    if (codec.decode_range(out, input, offset, size, start, end)) {
+        return 1;
+    }
+
+    // Rows only ever move towards the start of the buffer, so this can be done in place
+    uint32_t region_stride = region.width * 4;
+    for (uint32_t row=0; row<region.height; ++row) {
+        std::memmove(out.at(row * region_stride), out.at(row * stride + region.x * 4), region_stride);
+    }
+    out.seek(region.height * region_stride, Buffer::SET);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "util.hpp"
+
+// How much room past the requested range ImageCodec::decode_range may use
+constexpr const uint32_t DECODE_RANGE_SCRATCH = 0x40000;
+
+// A compression format used for image payloads in the archive
+struct ImageCodec {
+    const char* name;
+
+    // Whether the payload looks like it's in this format. This only has to be a cheap
+    // sanity check, a payload that passes it can still fail to decode.
+    bool (*sniff)(const uint8_t* data, uint32_t size);
+
+    // Decodes `size` bytes at `offset` of `input` into `out`, starting at out's current offset.
+    // `out` must already be large enough for the decoded image; the decoded size is out.tell()
+    // afterwards. `input` is seeked around, so it shouldn't be shared between threads.
+    // Returns 0 on success.
+    int (*decode)(Buffer& out, Buffer& input, uint32_t offset, uint32_t size);
+
+    // Like decode, but only produces bytes [start, end) of the decoded image, doing as little
+    // work as the format allows for the parts outside of that range. It may use up to
+    // DECODE_RANGE_SCRATCH bytes of `out` past the range as scratch space, and never more.
+    int (*decode_range)(Buffer& out, Buffer& input, uint32_t offset, uint32_t size, uint32_t start, uint32_t end);
+};
+
+struct image_region {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+// Parses an ImageMagick-style geometry string, WxH+X+Y
+bool parse_image_region(const std::string& geometry, image_region& region);
+
+// Shrinks the region to fit in an image of the given size. Returns false if nothing is left of it.
+bool clip_image_region(image_region& region, uint32_t image_width, uint32_t image_height);
+
+// Decodes just the rows covered by `region` and crops them to its columns, leaving out with
+// region.width * region.height * 4 bytes of RGBA pixels. `out` needs room for the whole rows
+// plus DECODE_RANGE_SCRATCH.
+int decode_image_region(
+  const ImageCodec& codec, Buffer& out, Buffer& input, uint32_t offset, uint32_t size,
+  uint32_t image_width, const image_region& region);
+
+// Codecs are sniffed in the order they were registered. zlib and chowimg are always registered.
+// Not thread-safe, register everything before starting to decode. Pointers returned by
+// find_image_codec and sniff_image_codec stay valid when more codecs are registered.
+void register_image_codec(const ImageCodec& codec);
+
+const ImageCodec* find_image_codec(const std::string& name);
+
+// Returns the first codec which recognises the payload, or nullptr if none do
+const ImageCodec* sniff_image_codec(const uint8_t* data, uint32_t size);
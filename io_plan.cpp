@@ -0,0 +1,35 @@
+#include "io_plan.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+void sort_entries_by_offset(const AssetIndex& index, asset_section section, std::vector<uint32_t>& entries) {
+    uint32_t begin = index.begin(section);
+    std::stable_sort(entries.begin(), entries.end(), [&](uint32_t a, uint32_t b) {
+        return index.entry_offset[begin + a] < index.entry_offset[begin + b];
+    });
+}
+
+ReadaheadWindow::ReadaheadWindow(int fd, uint32_t file_size, uint32_t window) {
+    this->fd = fd;
+    this->file_size = file_size;
+    this->window = window;
+}
+
+void ReadaheadWindow::advance(uint32_t offset) {
+    uint64_t end = std::min<uint64_t>(static_cast<uint64_t>(offset) + this->window, this->file_size);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    // Advising again every entry would mostly repeat what's already requested, so the window
+    // is only topped up once it's half used
+    if (offset + static_cast<uint64_t>(this->window / 2) < this->advised_end) {
+        return;
+    }
+    uint32_t start = std::max(offset, this->advised_end);
+    if (end > start) {
+        readahead_file_range(this->fd, start, end - start);
+        this->advised_end = end;
+    }
+}
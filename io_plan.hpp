@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "asset_index.hpp"
+
+// Readahead is issued this far past the entry being read
+constexpr const uint32_t READAHEAD_WINDOW = 8 << 20;
+
+// Reorders entry numbers so that they're visited in the order their data appears in the file.
+// The offset tables aren't in file order (audio especially), and on a cold cache or slow storage
+// reading entries in table order means seeking all over the file. Output files are still named
+// after the entry numbers, so this only changes the order they're written in.
+void sort_entries_by_offset(const AssetIndex& index, asset_section section, std::vector<uint32_t>& entries);
+
+// Keeps the kernel reading ahead of the extractors. Entries should be visited in file order (see
+// sort_entries_by_offset), then every call to advance makes sure the next `window` bytes after the
+// entry are on their way into the page cache. Safe to call from several workers at once.
+class ReadaheadWindow {
+    int fd;
+    uint32_t file_size;
+    uint32_t window;
+    uint32_t advised_end = 0;
+    std::mutex mutex;
+public:
+    ReadaheadWindow(int fd, uint32_t file_size, uint32_t window = READAHEAD_WINDOW);
+
+    // Call before reading the entry at `offset`
+    void advance(uint32_t offset);
+};
@@ -0,0 +1,43 @@
+#include "memory_budget.hpp"
+#include <cstdint>
+#include <mutex>
+
+MemoryBudget::MemoryBudget(uint64_t limit) {
+    this->limit = limit;
+}
+
+void MemoryBudget::acquire(uint64_t amount) {
+    if (!this->limit) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (amount > this->limit) {
+        ++this->oversized_waiting;
+        this->released.wait(lock, [&] { return this->in_use == 0; });
+        --this->oversized_waiting;
+    } else {
+        this->released.wait(lock, [&] {
+            return this->oversized_waiting == 0 && (this->in_use == 0 || this->in_use + amount <= this->limit);
+        });
+    }
+    this->in_use += amount;
+}
+
+void MemoryBudget::release(uint64_t amount) {
+    if (!this->limit) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->in_use -= amount;
+    }
+    this->released.notify_all();
+}
+
+MemoryReservation::MemoryReservation(MemoryBudget& budget, uint64_t amount) : budget(budget), amount(amount) {
+    this->budget.acquire(this->amount);
+}
+
+MemoryReservation::~MemoryReservation() {
+    this->budget.release(this->amount);
+}
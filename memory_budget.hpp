@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Limits how much memory decoders may have in use at once. acquire blocks until the amount
+// fits in what's left of the budget. An amount larger than the whole budget is admitted only
+// once nothing else is in use (and blocks everyone else until it's released), so oversized
+// entries are still handled, just one at a time. While one is waiting for that, nothing else
+// gets admitted, or a steady stream of smaller entries could keep it waiting forever.
+class MemoryBudget {
+    uint64_t limit;
+    uint64_t in_use = 0;
+    uint32_t oversized_waiting = 0;
+    std::mutex mutex;
+    std::condition_variable released;
+public:
+    // A limit of 0 means there is no limit
+    MemoryBudget(uint64_t limit);
+
+    void acquire(uint64_t amount);
+    void release(uint64_t amount);
+
+    inline uint64_t get_limit() const { return this->limit; };
+};
+
+// Holds a part of the budget for as long as it's in scope
+class MemoryReservation {
+    MemoryBudget& budget;
+    uint64_t amount;
+public:
+    MemoryReservation(MemoryBudget& budget, uint64_t amount);
+    MemoryReservation(MemoryReservation&&) = delete;
+    ~MemoryReservation();
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the user didn't ask for a specific amount
+inline unsigned default_job_count() {
+    unsigned count = std::thread::hardware_concurrency();
+    return count ? count : 1;
+}
+
+// Calls fn(item, worker) for every item in [0, count), spread over up to `jobs` threads.
+// Items are handed out in increasing order; `worker` is in [0, jobs) and can be used to
+// index per-thread state. fn must not throw.
+template <typename F>
+void parallel_for(unsigned jobs, uint32_t count, F fn) {
+    if (jobs > count) jobs = count;
+    if (jobs <= 1) {
+        for (uint32_t i=0; i<count; ++i) fn(i, 0u);
+        return;
+    }
+
+    std::atomic<uint32_t> next(0);
+    std::vector<std::thread> threads;
+    threads.reserve(jobs);
+    for (unsigned worker=0; worker<jobs; ++worker) {
+        threads.emplace_back([&, worker] {
+            for (uint32_t i=next++; i<count; i=next++) fn(i, worker);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+// Like parallel_for, for items that can themselves be split over several threads: fn(item, worker,
+// item_jobs) gets how many jobs the item may use. The items for which is_large(item) is true are
+// left until all the others are done and then run one at a time with all `jobs`, as they'd
+// otherwise keep one worker busy long after the rest have run out of items. The others get
+// whatever jobs are left over when there are fewer of them than jobs.
+template <typename L, typename F>
+void parallel_for_large_last(unsigned jobs, uint32_t count, L is_large, F fn) {
+    std::vector<uint32_t> small_items, large_items;
+    for (uint32_t i=0; i<count; ++i) {
+        (is_large(i) ? large_items : small_items).push_back(i);
+    }
+
+    unsigned small_jobs = small_items.empty()
+      ? 1 : std::max<unsigned>(1, jobs / std::min<size_t>(jobs, small_items.size()));
+    parallel_for(jobs, small_items.size(), [&](uint32_t i, unsigned worker) {
+        fn(small_items[i], worker, small_jobs);
+    });
+    for (uint32_t i : large_items) fn(i, 0u, jobs);
+}
@@ -0,0 +1,218 @@
+#include "png_write.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "stb/stb_image_write.h"
+
+// Each piece of the filtered image is deflated separately, with the end of the previous piece as
+// its dictionary so that the compression ratio barely suffers
+constexpr const uint32_t DEFLATE_PIECE_SIZE = 0x40000;
+constexpr const uint32_t DEFLATE_WINDOW_SIZE = 0x8000;
+
+// PNG chunks can't be longer than 2^31 - 1 bytes
+constexpr const uint32_t MAX_CHUNK_SIZE = 0x7fffffff;
+
+struct deflate_piece {
+    std::vector<uint8_t> data;
+    uint32_t crc;
+};
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// `prev` is the unfiltered previous row, or all zeroes for the first one
+static void filter_row(uint8_t* out, const uint8_t* row, const uint8_t* prev, uint32_t stride, int type) {
+    for (uint32_t i=0; i<stride; ++i) {
+        uint8_t left = i >= 4 ? row[i - 4] : 0;
+        uint8_t up_left = i >= 4 ? prev[i - 4] : 0;
+        switch (type) {
+            case 0: out[i] = row[i]; break;
+            case 1: out[i] = row[i] - left; break;
+            case 2: out[i] = row[i] - prev[i]; break;
+            case 3: out[i] = row[i] - ((left + prev[i]) >> 1); break;
+            case 4: out[i] = row[i] - paeth(left, prev[i], up_left); break;
+        }
+    }
+}
+
+// Same heuristic as stb_image_write: use the filter whose output has the smallest sum of
+// absolute values (as signed bytes). `out` receives the filter type byte followed by the row.
+static void filter_row_best(uint8_t* out, const uint8_t* row, const uint8_t* prev, uint32_t stride) {
+    uint64_t best_estimate = UINT64_MAX;
+    for (int type=0; type<5; ++type) {
+        filter_row(out + 1, row, prev, stride, type);
+        uint64_t estimate = 0;
+        for (uint32_t i=0; i<stride; ++i) {
+            estimate += abs(static_cast<int8_t>(out[i + 1]));
+        }
+        if (estimate < best_estimate) {
+            best_estimate = estimate;
+            out[0] = type;
+        }
+    }
+    if (out[0] != 4) {
+        filter_row(out + 1, row, prev, stride, out[0]);
+    }
+}
+
+static int deflate_piece_of(deflate_piece& piece, const uint8_t* data, uint32_t size,
+  const uint8_t* dictionary, uint32_t dictionary_size, bool last, int level) {
+    z_stream stream = {};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 1;
+    }
+    if (dictionary_size) {
+        deflateSetDictionary(&stream, dictionary, dictionary_size);
+    }
+
+    // A sync flush adds an empty stored block (5 bytes) on top of the bound
+    piece.data.resize(deflateBound(&stream, size) + 16);
+    stream.next_in = const_cast<uint8_t*>(data);
+    stream.avail_in = size;
+    stream.next_out = piece.data.data();
+    stream.avail_out = piece.data.size();
+    int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool success = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0);
+    piece.data.resize(stream.total_out);
+    deflateEnd(&stream);
+    return success ? 0 : 1;
+}
+
+// Unlike the archive, PNG is big endian
+static void write_big_endian_u32(uint8_t* data, uint32_t val) {
+    *data = (val >> 24) & 0xff;
+    *(data + 1) = (val >> 16) & 0xff;
+    *(data + 2) = (val >> 8) & 0xff;
+    *(data + 3) = val & 0xff;
+}
+
+static void put_u32_be(FILE* out, uint32_t val) {
+    uint8_t bytes[4];
+    write_big_endian_u32(bytes, val);
+    fwrite(bytes, sizeof(bytes), 1, out);
+}
+
+static void put_chunk_header(FILE* out, uint32_t length, const char* type) {
+    put_u32_be(out, length);
+    fwrite(type, 4, 1, out);
+}
+
+static int write_png_parallel(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* pixels, unsigned jobs) {
+    uint32_t stride = width * 4;
+    uint64_t filtered_size = static_cast<uint64_t>(stride + 1) * height;
+    std::unique_ptr<uint8_t[]> filtered(new uint8_t[filtered_size]);
+    std::vector<uint8_t> zero_row(stride, 0);
+
+    parallel_for(jobs, height, [&](uint32_t y, unsigned) {
+        const uint8_t* prev = y ? pixels + static_cast<uint64_t>(y - 1) * stride : zero_row.data();
+        filter_row_best(filtered.get() + y * static_cast<uint64_t>(stride + 1), 
+          pixels + static_cast<uint64_t>(y) * stride, prev, stride);
+    });
+
+    // The zlib header and the adler32 trailer are pieces of their own, so that the IDAT chunks
+    // can be cut between any two pieces
+    uint32_t deflate_piece_count = (filtered_size + DEFLATE_PIECE_SIZE - 1) / DEFLATE_PIECE_SIZE;
+    std::vector<deflate_piece> pieces(deflate_piece_count + 2);
+    std::vector<uLong> adlers(deflate_piece_count);
+    std::vector<int> failed(deflate_piece_count);
+
+    int level = stbi_write_png_compression_level;
+    parallel_for(jobs, deflate_piece_count, [&](uint32_t i, unsigned) {
+        uint64_t start = static_cast<uint64_t>(i) * DEFLATE_PIECE_SIZE;
+        uint32_t size = std::min<uint64_t>(DEFLATE_PIECE_SIZE, filtered_size - start);
+        uint32_t dictionary_size = std::min<uint64_t>(DEFLATE_WINDOW_SIZE, start);
+        deflate_piece& piece = pieces[i + 1];
+
+        failed[i] = deflate_piece_of(piece, filtered.get() + start, size,
+          filtered.get() + start - dictionary_size, dictionary_size, i + 1 == deflate_piece_count, level);
+        piece.crc = crc32(0, piece.data.data(), piece.data.size());
+        adlers[i] = adler32(adler32(0, nullptr, 0), filtered.get() + start, size);
+    });
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+        return 1;
+    }
+
+    uLong adler = adler32(0, nullptr, 0);
+    for (uint32_t i=0; i<deflate_piece_count; ++i) {
+        uint64_t start = static_cast<uint64_t>(i) * DEFLATE_PIECE_SIZE;
+        adler = adler32_combine(adler, adlers[i], std::min<uint64_t>(DEFLATE_PIECE_SIZE, filtered_size - start));
+    }
+    // Deflate with a 32k window, no preset dictionary (that's only used internally between pieces)
+    pieces.front().data = {0x78, 0xda};
+    pieces.back().data.resize(4);
+    write_big_endian_u32(pieces.back().data.data(), adler);
+    pieces.front().crc = crc32(0, pieces.front().data.data(), 2);
+    pieces.back().crc = crc32(0, pieces.back().data.data(), 4);
+
+    FILE* out = fopen(filename.c_str(), "wb");
+    if (!out) {
+        return 1;
+    }
+
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, sizeof(signature), 1, out);
+
+    uint8_t ihdr[17] = {'I', 'H', 'D', 'R'};
+    write_big_endian_u32(ihdr + 4, width);
+    write_big_endian_u32(ihdr + 8, height);
+    ihdr[12] = 8;   // Bit depth
+    ihdr[13] = 6;   // RGBA
+    put_u32_be(out, 13);
+    fwrite(ihdr, sizeof(ihdr), 1, out);
+    put_u32_be(out, crc32(0, ihdr, sizeof(ihdr)));
+
+    // Normally all of it fits into one IDAT chunk, but images that compress really badly might not
+    const uLong idat_crc = crc32(0, reinterpret_cast<const uint8_t*>("IDAT"), 4);
+    size_t first = 0;
+    while (first < pieces.size()) {
+        size_t last = first;
+        uint64_t length = 0;
+        while (last < pieces.size() && length + pieces[last].data.size() <= MAX_CHUNK_SIZE) {
+            length += pieces[last].data.size();
+            ++last;
+        }
+
+        uLong crc = idat_crc;
+        put_chunk_header(out, length, "IDAT");
+        for (size_t i=first; i<last; ++i) {
+            fwrite(pieces[i].data.data(), pieces[i].data.size(), 1, out);
+            crc = crc32_combine(crc, pieces[i].crc, pieces[i].data.size());
+        }
+        put_u32_be(out, crc);
+        first = last;
+    }
+
+    put_chunk_header(out, 0, "IEND");
+    put_u32_be(out, crc32(0, reinterpret_cast<const uint8_t*>("IEND"), 4));
+
+    bool write_failed = ferror(out);
+    return (fclose(out) || write_failed) ? 1 : 0;
+}
+
+int write_png(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* pixels, unsigned jobs) {
+    if (jobs > 1 && static_cast<uint64_t>(width) * height >= PARALLEL_PNG_MIN_PIXELS) {
+        return write_png_parallel(filename, width, height, pixels, jobs);
+    }
+    return stbi_write_png(filename.c_str(), width, height, 4, pixels, width * 4) ? 0 : 1;
+}
+
+uint64_t png_encode_memory(uint32_t width, uint32_t height) {
+    uint64_t filtered_size = (static_cast<uint64_t>(width) * 4 + 1) * height;
+    uint64_t piece_count = filtered_size / DEFLATE_PIECE_SIZE + 1;
+    // Stored blocks cost 5 bytes per 64 KiB, plus the sync flush and some slack per piece
+    uint64_t compressed_bound = filtered_size + (filtered_size >> 12) + piece_count * 32;
+    return filtered_size + compressed_bound;
+}
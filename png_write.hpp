@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Images with at least this many pixels are compressed on several threads by write_png
+constexpr const uint64_t PARALLEL_PNG_MIN_PIXELS = 1024 * 1024;
+
+// Writes 8-bit RGBA pixels to a PNG file. Small images go through stbi_write_png. Large ones are
+// filtered and deflated in independent pieces on up to `jobs` threads (like pigz does, with sync
+// flushes between the pieces), which are then stitched together into one zlib stream.
+// Both use stbi_write_png_compression_level. Returns 0 on success.
+int write_png(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* pixels, unsigned jobs);
+
+// Memory write_png allocates on top of the pixels, with either encoder: the filtered image and
+// the compressed data, which in the worst case is slightly larger than the filtered image
+uint64_t png_encode_memory(uint32_t width, uint32_t height);
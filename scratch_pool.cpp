@@ -0,0 +1,100 @@
+#include "scratch_pool.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Blocks at least this big are allocated as whole huge pages when huge pages are enabled
+constexpr const uint32_t HUGE_PAGE_SIZE = 0x200000;
+
+ScratchPool::ScratchPool(uint64_t retain_limit, bool huge_pages) {
+    this->retain_limit = retain_limit;
+    this->huge_pages = huge_pages;
+}
+
+ScratchPool::~ScratchPool() {
+    for (const block& block : this->free_blocks) {
+        release(block);
+    }
+}
+
+uint8_t* ScratchPool::allocate_new(uint32_t& size) {
+#ifdef __linux__
+    if (this->huge_pages && size >= HUGE_PAGE_SIZE) {
+        uint64_t rounded = (static_cast<uint64_t>(size) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        if (rounded <= UINT32_MAX) {
+            // mmap only aligns to normal pages, and a huge page can't straddle a 2 MiB boundary.
+            // Map an extra huge page worth and cut off what's outside the aligned part.
+            uint64_t mapped_size = rounded + HUGE_PAGE_SIZE;
+            void* mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping != MAP_FAILED) {
+                uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+                uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~static_cast<uintptr_t>(HUGE_PAGE_SIZE - 1);
+                if (aligned > start) {
+                    munmap(mapping, aligned - start);
+                }
+                if (start + mapped_size > aligned + rounded) {
+                    munmap(reinterpret_cast<void*>(aligned + rounded), start + mapped_size - aligned - rounded);
+                }
+
+                uint8_t* data = reinterpret_cast<uint8_t*>(aligned);
+                madvise(data, rounded, MADV_HUGEPAGE);
+                this->mapped_blocks.insert(data);
+                size = rounded;
+                return data;
+            }
+        }
+    }
+#endif
+    return static_cast<uint8_t*>(malloc(size));
+}
+
+void ScratchPool::release(const block& block) {
+#ifdef __linux__
+    if (this->mapped_blocks.erase(block.data)) {
+        munmap(block.data, block.size);
+        return;
+    }
+#endif
+    free(block.data);
+}
+
+uint8_t* ScratchPool::allocate(uint32_t& size) {
+    // The smallest free block that's large enough
+    auto best = this->free_blocks.end();
+    for (auto it=this->free_blocks.begin(); it!=this->free_blocks.end(); ++it) {
+        if (it->size >= size && (best == this->free_blocks.end() || it->size < best->size)) {
+            best = it;
+        }
+    }
+
+    if (best != this->free_blocks.end()) {
+        uint8_t* data = best->data;
+        size = best->size;
+        this->free_size -= best->size;
+        this->free_blocks.erase(best);
+        return data;
+    }
+    return allocate_new(size);
+}
+
+void ScratchPool::deallocate(uint8_t* data, uint32_t size) {
+    if (!data) {
+        return;
+    }
+    this->free_blocks.push_back({data, size});
+    this->free_size += size;
+
+    // Over the limit, drop the smallest blocks first; the large ones are the expensive ones to get again
+    std::sort(this->free_blocks.begin(), this->free_blocks.end(), [](const block& a, const block& b) {
+        return a.size > b.size;
+    });
+    while (this->free_size > this->retain_limit) {
+        release(this->free_blocks.back());
+        this->free_size -= this->free_blocks.back().size;
+        this->free_blocks.pop_back();
+    }
+}
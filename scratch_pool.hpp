@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+#include "util.hpp"
+
+// How much a pool keeps when there's no memory budget to take a share of
+constexpr const uint64_t DEFAULT_SCRATCH_RETAIN_LIMIT = 0x4000000;
+
+// A BufferAllocator that keeps freed blocks around and hands them out again, so that decoding
+// one entry after another doesn't allocate (and fault in fresh pages) every time. Not thread-safe,
+// the idea is to have one pool per worker thread.
+class ScratchPool : public BufferAllocator {
+    struct block {
+        uint8_t* data;
+        uint32_t size;
+    };
+
+    std::vector<block> free_blocks;
+    std::unordered_set<uint8_t*> mapped_blocks;  // Huge page blocks, which need munmap instead of free
+    uint64_t free_size = 0;
+    uint64_t retain_limit;
+    bool huge_pages;
+
+    uint8_t* allocate_new(uint32_t& size);
+    void release(const block& block);
+public:
+    // At most retain_limit bytes of freed blocks are kept (0 = none, every block is freed right
+    // away). With huge_pages, large blocks are allocated as whole, aligned huge pages so that the
+    // kernel can back them with transparent huge pages.
+    ScratchPool(uint64_t retain_limit, bool huge_pages);
+    ScratchPool(ScratchPool&&) = delete;
+    ~ScratchPool();
+
+    uint8_t* allocate(uint32_t& size) override;
+    void deallocate(uint8_t* data, uint32_t size) override;
+};
@@ -0,0 +1,184 @@
+#include "shard.hpp"
+#include "audio_meta.hpp"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+bool parse_shard_spec(const std::string& str, shard_spec& shard) {
+    char trailing;
+    if (std::sscanf(str.c_str(), "%u/%u%c", &shard.number, &shard.count, &trailing) != 2) {
+        return false;
+    }
+    return shard.count > 0 && shard.number >= 1 && shard.number <= shard.count;
+}
+
+void shard_entries(const AssetIndex& index, std::vector<uint32_t> (&entries)[SECTION_COUNT], const shard_spec& shard) {
+    // (bytes so far, shard index), the least loaded shard on top
+    typedef std::pair<uint64_t, uint32_t> shard_load;
+    std::priority_queue<shard_load, std::vector<shard_load>, std::greater<shard_load>> loads;
+    for (uint32_t i=0; i<shard.count; ++i) {
+        loads.push(shard_load(0, i));
+    }
+
+    for (int section_id=0; section_id<SECTION_COUNT; ++section_id) {
+        asset_section section = static_cast<asset_section>(section_id);
+        auto entry_size = [&](uint32_t entry_number) {
+            uint32_t entry = index.begin(section) + entry_number;
+            return index.entry_end(section, entry) - index.entry_offset[entry];
+        };
+
+        std::vector<uint32_t> by_size(entries[section]);
+        std::sort(by_size.begin(), by_size.end(), [&](uint32_t a, uint32_t b) {
+            uint32_t size_a = entry_size(a), size_b = entry_size(b);
+            return size_a != size_b ? size_a > size_b : a < b;
+        });
+
+        std::vector<uint32_t> own;
+        for (uint32_t entry_number : by_size) {
+            shard_load least = loads.top();
+            loads.pop();
+            if (least.second == shard.number - 1) {
+                own.push_back(entry_number);
+            }
+            least.first += entry_size(entry_number);
+            loads.push(least);
+        }
+
+        // Back in entry order, like the lists this was given
+        std::sort(own.begin(), own.end());
+        entries[section] = own;
+    }
+}
+
+std::string shard_summary_filename(const shard_spec& shard) {
+    return "shard-" + std::to_string(shard.number) + "-of-" + std::to_string(shard.count) + ".txt";
+}
+
+std::string shard_audio_index_filename(const shard_spec& shard) {
+    return "audio-index-shard-" + std::to_string(shard.number) + "-of-" + std::to_string(shard.count) + ".json";
+}
+
+// The summary is plain text, a header line followed by one line per section:
+//   shard K N archive_size
+//   <section> <entries> <bytes> <written>
+int write_shard_summary(const std::string& output_dir_path, const shard_summary& summary) {
+    std::string filename = output_dir_path + "/" + shard_summary_filename(summary.shard);
+    std::ofstream out(filename);
+    out << "shard " << summary.shard.number << " " << summary.shard.count << " " << summary.archive_size << "\n";
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        out << asset_section_names[section] << " " << summary.entries[section] << " "
+          << summary.bytes[section] << " " << summary.written[section] << "\n";
+    }
+    out.close();
+    if (!out) {
+        std::cerr << "failed to write " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int read_shard_summary(const std::string& path, shard_summary& summary) {
+    std::ifstream in(path);
+    std::string tag;
+    if (!(in >> tag >> summary.shard.number >> summary.shard.count >> summary.archive_size) || tag != "shard") {
+        return 1;
+    }
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        if (!(in >> tag >> summary.entries[section] >> summary.bytes[section] >> summary.written[section])
+          || tag != asset_section_names[section]) {
+            return 1;
+        }
+    }
+    return (summary.shard.number >= 1 && summary.shard.number <= summary.shard.count) ? 0 : 1;
+}
+
+int merge_shard_summaries(const std::string& output_dir_path, std::ostream& out) {
+    boost::system::error_code error;
+    fs::directory_iterator dir_iterator(output_dir_path, error);
+    if (error) {
+        std::cerr << output_dir_path << ": " << error.message() << std::endl;
+        return 1;
+    }
+
+    std::vector<shard_summary> summaries;
+    for (; dir_iterator != fs::directory_iterator(); dir_iterator.increment(error)) {
+        if (error) {
+            std::cerr << output_dir_path << ": " << error.message() << std::endl;
+            return 1;
+        }
+        const fs::directory_entry& dir_entry = *dir_iterator;
+        std::string filename = dir_entry.path().filename().string();
+        if (filename.compare(0, 6, "shard-") || dir_entry.path().extension() != ".txt") {
+            continue;
+        }
+        shard_summary summary;
+        if (read_shard_summary(dir_entry.path().string(), summary)) {
+            std::cerr << dir_entry.path().string() << ": not a valid shard summary" << std::endl;
+            return 1;
+        }
+        summaries.push_back(summary);
+    }
+
+    if (summaries.empty()) {
+        std::cerr << output_dir_path << ": no shard summaries found" << std::endl;
+        return 1;
+    }
+
+    uint32_t shard_count = summaries[0].shard.count;
+    uint64_t archive_size = summaries[0].archive_size;
+    std::vector<uint8_t> seen(shard_count);
+    for (const shard_summary& summary : summaries) {
+        if (summary.shard.count != shard_count || summary.archive_size != archive_size) {
+            std::cerr << "shard summaries are from different runs (shard " << summary.shard.number << "/"
+              << summary.shard.count << " doesn't match " << summaries[0].shard.number << "/" << shard_count
+              << "), remove the stale ones" << std::endl;
+            return 1;
+        }
+        seen[summary.shard.number - 1] = 1;
+    }
+
+    bool missing = false;
+    for (uint32_t i=0; i<shard_count; ++i) {
+        if (!seen[i]) {
+            std::cerr << "missing summary of shard " << i + 1 << "/" << shard_count << std::endl;
+            missing = true;
+        }
+    }
+
+    bool incomplete = false;
+    out << "Merged " << summaries.size() << " of " << shard_count << " shards" << std::endl;
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        uint32_t entries = 0, written = 0;
+        uint64_t bytes = 0;
+        for (const shard_summary& summary : summaries) {
+            entries += summary.entries[section];
+            bytes += summary.bytes[section];
+            written += summary.written[section];
+        }
+        out << "  " << asset_section_names[section] << ": " << written << " of " << entries
+          << " written (" << bytes << " bytes)" << std::endl;
+        incomplete |= written < entries;
+    }
+
+    std::vector<std::string> audio_indexes;
+    for (const shard_summary& summary : summaries) {
+        fs::path path = fs::path(output_dir_path) / shard_audio_index_filename(summary.shard);
+        if (fs::exists(path)) {
+            audio_indexes.push_back(path.string());
+        }
+    }
+    if (!audio_indexes.empty() && merge_audio_indexes(audio_indexes, output_dir_path + "/" AUDIO_INDEX_FILENAME)) {
+        return 1;
+    }
+    return (missing || incomplete) ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "asset_index.hpp"
+
+// One of `count` processes sharing an extraction, numbered from 1
+struct shard_spec {
+    uint32_t number;
+    uint32_t count;
+};
+
+// Parses K/N, returns false if it's malformed or K isn't in 1..N
+bool parse_shard_spec(const std::string& str, shard_spec& shard);
+
+// Keeps only the entries that belong to `shard`. Every shard computes the same partition from the
+// same index and entry lists: entries are handed out largest first to whichever shard has the
+// fewest bytes so far, with ties going to the lower entry/shard number. Sections share the
+// running totals, so a shard that got a large image is less likely to also get a large sound.
+void shard_entries(const AssetIndex& index, std::vector<uint32_t> (&entries)[SECTION_COUNT], const shard_spec& shard);
+
+// What a shard did with each section
+struct shard_summary {
+    shard_spec shard;
+    uint64_t archive_size;
+    uint32_t entries[SECTION_COUNT] = {};
+    uint64_t bytes[SECTION_COUNT] = {};     // Size of the assigned entries in the archive
+    uint32_t written[SECTION_COUNT] = {};
+};
+
+std::string shard_summary_filename(const shard_spec& shard);
+
+// Each shard writes its own part of the audio index, which merging combines into AUDIO_INDEX_FILENAME
+std::string shard_audio_index_filename(const shard_spec& shard);
+
+// Both return 0 on success. A summary whose shard number isn't in 1..N counts as invalid.
+int write_shard_summary(const std::string& output_dir_path, const shard_summary& summary);
+int read_shard_summary(const std::string& path, shard_summary& summary);
+
+// Reads every shard's summary from `output_dir_path` and prints the totals, then combines the
+// shards' audio indexes. Returns 1 if any summary is missing or they don't agree on the archive
+// or shard count.
+int merge_shard_summaries(const std::string& output_dir_path, std::ostream& out);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <iostream>
+
+// Just enough for the test executables: a failed check is reported with its line and the test
+// carries on, check_result() then gives the exit code meson's test() expects.
+inline int& check_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++check_failures(); \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected) do { \
+        auto actual_value = (actual); \
+        auto expected_value = (expected); \
+        if (!(actual_value == expected_value)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #actual " == " #expected \
+              << " (got " << actual_value << ", expected " << expected_value << ")" << std::endl; \
+            ++check_failures(); \
+        } \
+    } while (0)
+
+inline int check_result() {
+    if (check_failures()) {
+        std::cerr << check_failures() << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
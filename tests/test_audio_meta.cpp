@@ -0,0 +1,216 @@
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../audio_meta.hpp"
+#include "../util.hpp"
+#include "check.hpp"
+
+namespace fs = boost::filesystem;
+
+static void put_u16(std::vector<uint8_t>& out, uint16_t val) {
+    uint8_t bytes[2];
+    write_little_endian_u16(bytes, val);
+    out.insert(out.end(), bytes, bytes + 2);
+}
+
+static void put_u32(std::vector<uint8_t>& out, uint32_t val) {
+    uint8_t bytes[4];
+    write_little_endian_u32(bytes, val);
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+static void put_tag(std::vector<uint8_t>& out, const char* tag) {
+    out.insert(out.end(), tag, tag + 4);
+}
+
+// 16-bit PCM, with an optional chunk the parser has to skip between fmt and data
+static std::vector<uint8_t> make_wav(uint16_t channels, uint32_t sample_rate, uint32_t frames, bool extra_chunk) {
+    std::vector<uint8_t> body;
+    put_tag(body, "WAVE");
+    put_tag(body, "fmt ");
+    put_u32(body, 16);
+    put_u16(body, 1);
+    put_u16(body, channels);
+    put_u32(body, sample_rate);
+    put_u32(body, sample_rate * channels * 2);
+    put_u16(body, channels * 2);
+    put_u16(body, 16);
+    if (extra_chunk) {
+        // Odd size, so it's followed by a padding byte
+        put_tag(body, "LIST");
+        put_u32(body, 5);
+        body.insert(body.end(), {'I', 'N', 'F', 'O', 0, 0});
+    }
+    put_tag(body, "data");
+    put_u32(body, frames * channels * 2);
+    body.resize(body.size() + frames * channels * 2);
+
+    std::vector<uint8_t> wav;
+    put_tag(wav, "RIFF");
+    put_u32(wav, body.size());
+    wav.insert(wav.end(), body.begin(), body.end());
+    return wav;
+}
+
+static uint32_t ogg_crc(const std::vector<uint8_t>& page) {
+    uint32_t crc = 0;
+    for (uint8_t byte : page) {
+        crc ^= static_cast<uint32_t>(byte) << 24;
+        for (int bit=0; bit<8; ++bit) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static std::vector<uint8_t> make_ogg_page(uint64_t granule, uint32_t serial, uint32_t sequence,
+  const std::vector<uint8_t>& packet, uint8_t flags, bool valid_crc = true) {
+    std::vector<uint8_t> page;
+    put_tag(page, "OggS");
+    page.push_back(0);
+    page.push_back(flags);
+    put_u32(page, granule & 0xffffffff);
+    put_u32(page, granule >> 32);
+    put_u32(page, serial);
+    put_u32(page, sequence);
+    put_u32(page, 0);
+    std::vector<uint8_t> segments;
+    uint32_t left = packet.size();
+    while (left >= 255) {
+        segments.push_back(255);
+        left -= 255;
+    }
+    segments.push_back(left);
+    page.push_back(segments.size());
+    page.insert(page.end(), segments.begin(), segments.end());
+    page.insert(page.end(), packet.begin(), packet.end());
+
+    write_little_endian_u32(page.data() + 22, ogg_crc(page) ^ (valid_crc ? 0 : 1));
+    return page;
+}
+
+static std::vector<uint8_t> make_vorbis(uint8_t channels, uint32_t sample_rate, uint64_t frames, uint32_t serial) {
+    std::vector<uint8_t> identification = {1, 'v', 'o', 'r', 'b', 'i', 's', 0, 0, 0, 0, channels};
+    put_u32(identification, sample_rate);
+    identification.resize(30);
+    std::vector<uint8_t> comment = {3, 'v', 'o', 'r', 'b', 'i', 's'};
+    comment.resize(40);
+
+    std::vector<uint8_t> ogg = make_ogg_page(0, serial, 0, identification, 2);
+    std::vector<uint8_t> page = make_ogg_page(0, serial, 1, comment, 0);
+    ogg.insert(ogg.end(), page.begin(), page.end());
+    // An audio packet that doesn't end on this page
+    page = make_ogg_page(UINT64_MAX, serial, 2, std::vector<uint8_t>(255, 0x55), 0);
+    ogg.insert(ogg.end(), page.begin(), page.end());
+    page = make_ogg_page(frames, serial, 3, std::vector<uint8_t>(300, 0x66), 4);
+    ogg.insert(ogg.end(), page.begin(), page.end());
+    return ogg;
+}
+
+static void test_wav() {
+    audio_info info;
+    std::vector<uint8_t> wav = make_wav(2, 44100, 4410, false);
+    CHECK(read_wav_info(wav.data(), wav.size(), info));
+    CHECK_EQUAL(info.channels, 2u);
+    CHECK_EQUAL(info.sample_rate, 44100u);
+    CHECK_EQUAL(info.frames, 4410u);
+
+    info = audio_info();
+    wav = make_wav(1, 22050, 1000, true);
+    CHECK(read_audio_info(1, wav.data(), wav.size(), info));
+    CHECK_EQUAL(info.channels, 1u);
+    CHECK_EQUAL(info.frames, 1000u);
+
+    // A data chunk cut short counts for what's there
+    wav.resize(wav.size() - 500);
+    CHECK(read_wav_info(wav.data(), wav.size(), info));
+    CHECK_EQUAL(info.frames, 750u);
+
+    // Headers cut off before the data chunk
+    CHECK(!read_wav_info(wav.data(), 30, info));
+    CHECK(!read_wav_info(wav.data(), 8, info));
+    std::vector<uint8_t> vorbis = make_vorbis(2, 48000, 1000, 1);
+    CHECK(!read_wav_info(vorbis.data(), vorbis.size(), info));
+}
+
+static void test_vorbis() {
+    audio_info info;
+    std::vector<uint8_t> ogg = make_vorbis(2, 48000, 96000, 0x1234);
+    CHECK(read_vorbis_info(ogg.data(), ogg.size(), info));
+    CHECK_EQUAL(info.channels, 2u);
+    CHECK_EQUAL(info.sample_rate, 48000u);
+    CHECK_EQUAL(info.frames, 96000u);
+
+    // A page of another logical stream after the end doesn't count
+    std::vector<uint8_t> other = make_ogg_page(5, 0x9999, 0, std::vector<uint8_t>(10, 0x77), 4);
+    std::vector<uint8_t> chained(ogg);
+    chained.insert(chained.end(), other.begin(), other.end());
+    CHECK(read_audio_info(2, chained.data(), chained.size(), info));
+    CHECK_EQUAL(info.frames, 96000u);
+
+    // Neither does one with a broken checksum
+    std::vector<uint8_t> broken = make_ogg_page(7, 0x1234, 4, std::vector<uint8_t>(10, 0x77), 4, false);
+    std::vector<uint8_t> damaged(ogg);
+    damaged.insert(damaged.end(), broken.begin(), broken.end());
+    CHECK(read_vorbis_info(damaged.data(), damaged.size(), info));
+    CHECK_EQUAL(info.frames, 96000u);
+
+    // Cut off inside the last page: the page before it only has -1, the comment page has 0
+    info = audio_info();
+    CHECK(read_vorbis_info(ogg.data(), ogg.size() - 100, info));
+    CHECK_EQUAL(info.frames, 0u);
+
+    std::vector<uint8_t> wav = make_wav(1, 8000, 10, false);
+    CHECK(!read_vorbis_info(wav.data(), wav.size(), info));
+    CHECK(!read_vorbis_info(ogg.data(), 20, info));
+}
+
+static std::string read_file(const fs::path& path) {
+    std::ifstream in(path.string());
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void test_index() {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("audio-meta-test-%%%%%%%%");
+    fs::create_directories(dir);
+
+    audio_index_entry parsed = {2, "audio2.ogg", 1000, true, audio_info()};
+    parsed.info.channels = 2;
+    parsed.info.sample_rate = 48000;
+    parsed.info.frames = 24000;
+    audio_index_entry unparsed = {0, "audio0.wav", AUDIO_STREAM_THRESHOLD + 1, false, audio_info()};
+    audio_index_entry other_shard = {1, "audio1.wav", 10, false, audio_info()};
+
+    CHECK_EQUAL(write_audio_index((dir / "a.json").string(), {parsed, unparsed}), 0);
+    CHECK_EQUAL(write_audio_index((dir / "b.json").string(), {other_shard}), 0);
+    CHECK_EQUAL(read_file(dir / "a.json"),
+      "[\n"
+      "  {\"index\": 0, \"file\": \"audio0.wav\", \"size\": 524289, \"stream\": true},\n"
+      "  {\"index\": 2, \"file\": \"audio2.ogg\", \"size\": 1000, \"stream\": false, \"channels\": 2, "
+      "\"sample_rate\": 48000, \"frames\": 24000, \"duration\": 0.500}\n"
+      "]\n");
+
+    CHECK_EQUAL(merge_audio_indexes({(dir / "a.json").string(), (dir / "b.json").string()},
+      (dir / "merged.json").string()), 0);
+    std::string merged = read_file(dir / "merged.json");
+    size_t first = merged.find("\"index\": 0"), second = merged.find("\"index\": 1"), third = merged.find("\"index\": 2");
+    CHECK(first != std::string::npos && second != std::string::npos && third != std::string::npos);
+    CHECK(first < second && second < third);
+
+    // Can't create a file where a directory is
+    fs::create_directories(dir / "taken.json");
+    CHECK_EQUAL(write_audio_index((dir / "taken.json").string(), {parsed}), 1);
+
+    fs::remove_all(dir);
+}
+
+int main() {
+    test_wav();
+    test_vorbis();
+    test_index();
+    return check_result();
+}
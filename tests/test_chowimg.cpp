@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+#include "../chowimg.hpp"
+#include "../image_codec.hpp"
+#include "../util.hpp"
+#include "check.hpp"
+
+// Payloads start this far into the input, like they do inside an archive
+constexpr const uint32_t PAYLOAD_OFFSET = 16;
+
+static void put_length_extension(std::vector<uint8_t>& out, uint32_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(length);
+}
+
+// One control byte with its literals and, if match_length isn't 0, a match
+static void put_op(std::vector<uint8_t>& out, const uint8_t* literals, uint32_t literal_count,
+  uint16_t distance, uint32_t match_length) {
+    uint8_t literal_nibble = std::min<uint32_t>(literal_count, 15);
+    uint8_t match_nibble = match_length ? std::min<uint32_t>(match_length - 4, 15) : 0;
+    out.push_back(literal_nibble << 4 | match_nibble);
+    if (literal_nibble == 15) put_length_extension(out, literal_count - 15);
+    out.insert(out.end(), literals, literals + literal_count);
+    if (!match_length) return;
+    out.push_back(distance & 0xff);
+    out.push_back(distance >> 8);
+    if (match_nibble == 15) put_length_extension(out, match_length - 4 - 15);
+}
+
+// A naive encoder: matches are searched for within the hunk only, and the hunk ends with a
+// literal run (possibly empty), which is how the decoder knows it's done
+static void put_hunk(std::vector<uint8_t>& out, const uint8_t* data, uint32_t size) {
+    std::vector<uint8_t> ops;
+    uint32_t literal_start = 0;
+    uint32_t i = 0;
+    while (i < size) {
+        uint32_t best_length = 0, best_distance = 0;
+        for (uint32_t distance=1; distance<=std::min<uint32_t>(i, 1024); ++distance) {
+            uint32_t length = 0;
+            while (i + length < size && data[i + length] == data[i + length - distance]) ++length;
+            if (length > best_length) {
+                best_length = length;
+                best_distance = distance;
+            }
+        }
+        if (best_length >= 4) {
+            put_op(ops, data + literal_start, i - literal_start, best_distance, best_length);
+            i += best_length;
+            literal_start = i;
+        } else {
+            ++i;
+        }
+    }
+    put_op(ops, data + literal_start, size - literal_start, 0, 0);
+
+    uint8_t size_bytes[4];
+    write_little_endian_u32(size_bytes, ops.size());
+    out.insert(out.end(), size_bytes, size_bytes + 4);
+    out.insert(out.end(), ops.begin(), ops.end());
+}
+
+static std::vector<uint8_t> chowimg_encode(const std::vector<uint8_t>& data, uint32_t hunk_size) {
+    std::vector<uint8_t> out;
+    for (uint32_t start=0; start<data.size(); start+=hunk_size) {
+        put_hunk(out, data.data() + start, std::min<uint32_t>(hunk_size, data.size() - start));
+    }
+    return out;
+}
+
+static std::vector<uint8_t> zlib_encode(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> out(compressBound(data.size()));
+    uLongf size = out.size();
+    compress(out.data(), &size, data.data(), data.size());
+    out.resize(size);
+    return out;
+}
+
+// Stripes and steps, so that most of it compresses, and a bit of gradient that doesn't
+static std::vector<uint8_t> make_pixels(uint32_t width, uint32_t height) {
+    std::vector<uint8_t> pixels(width * height * 4);
+    for (uint32_t y=0; y<height; ++y) {
+        for (uint32_t x=0; x<width; ++x) {
+            uint8_t* pixel = &pixels[(y * width + x) * 4];
+            pixel[0] = (x / 4) % 2 ? 0xff : 0x00;
+            pixel[1] = x / 8 * 16;
+            pixel[2] = y < 5 ? x * 7 + y : y / 4 * 8;
+            pixel[3] = 0xff;
+        }
+    }
+    return pixels;
+}
+
+static std::vector<uint8_t> with_prefix(const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> input(PAYLOAD_OFFSET + payload.size(), 0xcc);
+    std::copy(payload.begin(), payload.end(), input.begin() + PAYLOAD_OFFSET);
+    return input;
+}
+
+static int decode_with(const ImageCodec& codec, std::vector<uint8_t>& input, uint32_t decoded_size, std::vector<uint8_t>& decoded) {
+    Buffer in_buffer(input.data(), input.size());
+    Buffer out_buffer(decoded_size);
+    int result = codec.decode(out_buffer, in_buffer, PAYLOAD_OFFSET, input.size() - PAYLOAD_OFFSET);
+    decoded.assign(out_buffer.at(0), out_buffer.at(0) + out_buffer.tell());
+    return result;
+}
+
+static void test_full_decode() {
+    const uint32_t width = 37, height = 23;
+    std::vector<uint8_t> pixels = make_pixels(width, height);
+    std::vector<uint8_t> input = with_prefix(chowimg_encode(pixels, 200));
+    CHECK(input.size() - PAYLOAD_OFFSET < pixels.size());
+
+    const ImageCodec* codec = sniff_image_codec(input.data() + PAYLOAD_OFFSET, input.size() - PAYLOAD_OFFSET);
+    CHECK(codec && !std::strcmp(codec->name, "chowimg"));
+
+    std::vector<uint8_t> decoded;
+    CHECK_EQUAL(decode_with(*find_image_codec("chowimg"), input, pixels.size(), decoded), 0);
+    CHECK(decoded == pixels);
+}
+
+static void test_scan_hunks() {
+    std::vector<uint8_t> pixels = make_pixels(37, 23);
+    std::vector<uint8_t> input = with_prefix(chowimg_encode(pixels, 200));
+    Buffer in_buffer(input.data(), input.size());
+
+    std::vector<chowimg_hunk> hunks;
+    in_buffer.seek(PAYLOAD_OFFSET, Buffer::SET);
+    CHECK_EQUAL(chowimg_scan_hunks(hunks, in_buffer, input.size(), UINT32_MAX), 0);
+    CHECK_EQUAL(hunks.size(), (pixels.size() + 199) / 200);
+    uint32_t total = 0;
+    for (const chowimg_hunk& hunk : hunks) total += hunk.decompressed_size;
+    CHECK_EQUAL(total, pixels.size());
+    CHECK_EQUAL(hunks[0].offset, PAYLOAD_OFFSET);
+
+    // Stops after the hunk that reaches the limit, without looking at the rest
+    hunks.clear();
+    in_buffer.seek(PAYLOAD_OFFSET, Buffer::SET);
+    CHECK_EQUAL(chowimg_scan_hunks(hunks, in_buffer, input.size(), 250), 0);
+    CHECK_EQUAL(hunks.size(), 2u);
+}
+
+static void test_read_range() {
+    std::vector<uint8_t> pixels = make_pixels(37, 23);
+    std::vector<uint8_t> input = with_prefix(chowimg_encode(pixels, 200));
+
+    // Within one hunk, across hunk boundaries, starting and ending on them, and all of it
+    const uint32_t ranges[][2] = {{10, 50}, {150, 650}, {200, 400}, {0, 1}, {3000, 3404}, {0, 3404}};
+    for (const auto& range : ranges) {
+        Buffer in_buffer(input.data(), input.size());
+        Buffer out_buffer(range[1] - range[0]);
+        in_buffer.seek(PAYLOAD_OFFSET, Buffer::SET);
+        CHECK_EQUAL(chowimg_read_range(out_buffer, in_buffer, input.size(), range[0], range[1]), 0);
+        CHECK_EQUAL(out_buffer.tell(), range[1] - range[0]);
+        CHECK(!std::memcmp(out_buffer.at(0), pixels.data() + range[0], range[1] - range[0]));
+    }
+
+    // Past the end of the image
+    Buffer in_buffer(input.data(), input.size());
+    Buffer out_buffer(100);
+    in_buffer.seek(PAYLOAD_OFFSET, Buffer::SET);
+    CHECK_EQUAL(chowimg_read_range(out_buffer, in_buffer, input.size(), 3400, 3500), 1);
+}
+
+// A range at the end of a hunk much longer than the range has to fit in the range plus
+// CHOWIMG_SKIP_SCRATCH, however much of the hunk comes before it
+static void test_read_range_long_hunk() {
+    // Long runs too, which come out as matches longer than the rewind distance
+    std::vector<uint8_t> data = make_pixels(256, 256);
+    std::fill(data.begin() + 1000, data.begin() + 200000, 0x42);
+    std::vector<uint8_t> input = with_prefix(chowimg_encode(data, data.size()));
+
+    const uint32_t ranges[][2] = {{250000, 252000}, {150000, 150100}, {100, 199000}, {262000, 262144}};
+    for (const auto& range : ranges) {
+        Buffer in_buffer(input.data(), input.size());
+        uint32_t out_size = range[1] - range[0] + CHOWIMG_SKIP_SCRATCH;
+        Buffer out_buffer(out_size);
+        in_buffer.seek(PAYLOAD_OFFSET, Buffer::SET);
+        CHECK_EQUAL(chowimg_read_range(out_buffer, in_buffer, input.size(), range[0], range[1]), 0);
+        CHECK_EQUAL(out_buffer.get_size(), out_size);
+        CHECK_EQUAL(out_buffer.tell(), range[1] - range[0]);
+        CHECK(!std::memcmp(out_buffer.at(0), data.data() + range[0], range[1] - range[0]));
+    }
+
+    std::vector<uint8_t> decoded;
+    CHECK_EQUAL(decode_with(*find_image_codec("chowimg"), input, data.size(), decoded), 0);
+    CHECK(decoded == data);
+}
+
+static void test_decode_region() {
+    const uint32_t width = 37, height = 23;
+    std::vector<uint8_t> pixels = make_pixels(width, height);
+    const image_region region = {5, 3, 10, 7};
+
+    std::vector<uint8_t> expected;
+    for (uint32_t y=region.y; y<region.y + region.height; ++y) {
+        const uint8_t* row = pixels.data() + (y * width + region.x) * 4;
+        expected.insert(expected.end(), row, row + region.width * 4);
+    }
+
+    std::vector<std::vector<uint8_t>> inputs = {
+        with_prefix(chowimg_encode(pixels, 200)), with_prefix(zlib_encode(pixels))
+    };
+    const char* const codec_names[] = {"chowimg", "zlib"};
+    for (int i=0; i<2; ++i) {
+        const ImageCodec* codec = find_image_codec(codec_names[i]);
+        Buffer in_buffer(inputs[i].data(), inputs[i].size());
+        Buffer out_buffer(width * region.height * 4 + DECODE_RANGE_SCRATCH);
+        CHECK_EQUAL(decode_image_region(*codec, out_buffer, in_buffer, PAYLOAD_OFFSET,
+          inputs[i].size() - PAYLOAD_OFFSET, width, region), 0);
+        CHECK_EQUAL(out_buffer.tell(), expected.size());
+        CHECK(!std::memcmp(out_buffer.at(0), expected.data(), expected.size()));
+    }
+}
+
+static void test_region_parsing() {
+    image_region region;
+    CHECK(parse_image_region("10x7+5+3", region));
+    CHECK_EQUAL(region.width, 10u);
+    CHECK_EQUAL(region.x, 5u);
+    CHECK(!parse_image_region("10x7", region));
+    CHECK(!parse_image_region("10x7+5+3px", region));
+
+    region = {30, 20, 10, 10};
+    CHECK(clip_image_region(region, 37, 23));
+    CHECK_EQUAL(region.width, 7u);
+    CHECK_EQUAL(region.height, 3u);
+    region = {37, 0, 1, 1};
+    CHECK(!clip_image_region(region, 37, 23));
+}
+
+// Each of these has to be rejected without reading or writing outside of the buffers
+static void test_malformed_hunks() {
+    const std::vector<std::vector<uint8_t>> payloads = {
+        // 95 literals in a hunk with 1 byte left
+        {0x03, 0x00, 0x00, 0x00, 0xf0, 0x50, 0x01},
+        // Match distance 0
+        {0x05, 0x00, 0x00, 0x00, 0x10, 0x41, 0x00, 0x00, 0x00},
+        // Match reaching before the start of the hunk
+        {0x05, 0x00, 0x00, 0x00, 0x10, 0x41, 0x02, 0x00, 0x00},
+        // Match length extension past the end of the hunk
+        {0x04, 0x00, 0x00, 0x00, 0x1f, 0x41, 0x01, 0x00, 0xff, 0x00},
+        // Hunk larger than the input
+        {0xff, 0x00, 0x00, 0x00, 0x10, 0x41},
+    };
+    for (const std::vector<uint8_t>& payload : payloads) {
+        std::vector<uint8_t> input = with_prefix(payload);
+        std::vector<uint8_t> decoded;
+        CHECK_EQUAL(decode_with(*find_image_codec("chowimg"), input, 64, decoded), 1);
+
+        Buffer in_buffer(input.data(), input.size());
+        Buffer out_buffer(4);
+        CHECK_EQUAL(find_image_codec("chowimg")->decode_range(out_buffer, in_buffer, PAYLOAD_OFFSET,
+          input.size() - PAYLOAD_OFFSET, 0, 4), 1);
+    }
+
+    // A hunk that's fine by itself but runs past the end of the image data
+    std::vector<uint8_t> pixels = make_pixels(4, 4);
+    std::vector<uint8_t> input = with_prefix(chowimg_encode(pixels, 64));
+    Buffer in_buffer(input.data(), input.size());
+    Buffer out_buffer(pixels.size());
+    in_buffer.seek(PAYLOAD_OFFSET, Buffer::SET);
+    CHECK_EQUAL(chowimg_read(out_buffer, in_buffer, input.size() - 1), 1);
+}
+
+int main() {
+    test_full_decode();
+    test_scan_hunks();
+    test_read_range();
+    test_read_range_long_hunk();
+    test_decode_region();
+    test_region_parsing();
+    test_malformed_hunks();
+    return check_result();
+}
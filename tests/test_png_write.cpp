@@ -0,0 +1,181 @@
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+#include "../parallel.hpp"
+#include "../png_write.hpp"
+#include "check.hpp"
+
+namespace fs = boost::filesystem;
+
+static uint32_t read_big_endian_u32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Reads an 8-bit RGBA PNG with just enough of the format for what write_png produces, checking
+// every chunk's CRC on the way. Returns false if anything about it is off.
+static bool read_png(const std::string& filename, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixels) {
+    std::ifstream in(filename, std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (file.size() < 8 || std::memcmp(file.data(), signature, 8)) {
+        return false;
+    }
+
+    std::vector<uint8_t> compressed;
+    bool ended = false;
+    for (size_t offset=8; offset < file.size() && !ended;) {
+        if (file.size() - offset < 12) return false;
+        uint32_t length = read_big_endian_u32(&file[offset]);
+        if (file.size() - offset - 12 < length) return false;
+        const uint8_t* type = &file[offset + 4];
+        const uint8_t* data = &file[offset + 8];
+        if (crc32(0, type, length + 4) != read_big_endian_u32(data + length)) return false;
+
+        if (!std::memcmp(type, "IHDR", 4)) {
+            width = read_big_endian_u32(data);
+            height = read_big_endian_u32(data + 4);
+            if (data[8] != 8 || data[9] != 6) return false;
+        } else if (!std::memcmp(type, "IDAT", 4)) {
+            compressed.insert(compressed.end(), data, data + length);
+        } else if (!std::memcmp(type, "IEND", 4)) {
+            ended = true;
+        }
+        offset += 12 + length;
+    }
+    if (!ended) {
+        return false;
+    }
+
+    // uncompress checks the adler32 trailer too
+    uint32_t stride = width * 4;
+    std::vector<uint8_t> filtered((stride + 1) * static_cast<uint64_t>(height));
+    uLongf filtered_size = filtered.size();
+    if (uncompress(filtered.data(), &filtered_size, compressed.data(), compressed.size()) != Z_OK
+      || filtered_size != filtered.size()) {
+        return false;
+    }
+
+    pixels.assign(stride * static_cast<uint64_t>(height), 0);
+    std::vector<uint8_t> zero_row(stride, 0);
+    for (uint32_t y=0; y<height; ++y) {
+        const uint8_t* line = &filtered[y * static_cast<uint64_t>(stride + 1)];
+        uint8_t* row = &pixels[y * static_cast<uint64_t>(stride)];
+        const uint8_t* prev = y ? row - stride : zero_row.data();
+        for (uint32_t i=0; i<stride; ++i) {
+            uint8_t left = i >= 4 ? row[i - 4] : 0;
+            uint8_t up_left = i >= 4 ? prev[i - 4] : 0;
+            uint8_t value = line[i + 1];
+            switch (line[0]) {
+                case 0: row[i] = value; break;
+                case 1: row[i] = value + left; break;
+                case 2: row[i] = value + prev[i]; break;
+                case 3: row[i] = value + ((left + prev[i]) >> 1); break;
+                case 4: row[i] = value + paeth(left, prev[i], up_left); break;
+                default: return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Smooth gradients that the filters do well on, with a noisy band that doesn't compress
+static std::vector<uint8_t> make_pixels(uint32_t width, uint32_t height) {
+    std::vector<uint8_t> pixels(width * static_cast<uint64_t>(height) * 4);
+    uint32_t noise = 1;
+    for (uint32_t y=0; y<height; ++y) {
+        for (uint32_t x=0; x<width; ++x) {
+            uint8_t* pixel = &pixels[(y * static_cast<uint64_t>(width) + x) * 4];
+            noise = noise * 1103515245 + 12345;
+            bool noisy = y >= height / 3 && y < height / 2;
+            pixel[0] = noisy ? noise >> 24 : x;
+            pixel[1] = noisy ? noise >> 16 : y;
+            pixel[2] = (x + y) / 3;
+            pixel[3] = x % 7 ? 0xff : 0x80;
+        }
+    }
+    return pixels;
+}
+
+static void test_parallel(uint32_t width, uint32_t height, unsigned jobs) {
+    CHECK(static_cast<uint64_t>(width) * height >= PARALLEL_PNG_MIN_PIXELS);
+    fs::path path = fs::temp_directory_path() / fs::unique_path("png-write-test-%%%%%%%%.png");
+    std::vector<uint8_t> pixels = make_pixels(width, height);
+    CHECK_EQUAL(write_png(path.string(), width, height, pixels.data(), jobs), 0);
+
+    uint32_t read_width = 0, read_height = 0;
+    std::vector<uint8_t> read_pixels;
+    CHECK(read_png(path.string(), read_width, read_height, read_pixels));
+    CHECK_EQUAL(read_width, width);
+    CHECK_EQUAL(read_height, height);
+    CHECK(read_pixels == pixels);
+
+    // What the encoder may allocate is at least the filtered image plus the compressed file
+    CHECK(png_encode_memory(width, height) >= (width * 4 + 1) * static_cast<uint64_t>(height) + fs::file_size(path));
+    fs::remove(path);
+}
+
+// Like extract_images does it: with more images than jobs, the large ones still get all of the jobs
+static void test_large_images_get_all_jobs() {
+    const unsigned jobs = 4;
+    const uint32_t sizes[][2] = {{64, 64}, {1024, 1024}, {10, 10}, {300, 200}, {2000, 600}, {128, 128}, {5, 5}};
+    const uint32_t count = sizeof(sizes) / sizeof(sizes[0]);
+    auto large_png = [&](uint32_t i) {
+        return static_cast<uint64_t>(sizes[i][0]) * sizes[i][1] >= PARALLEL_PNG_MIN_PIXELS;
+    };
+
+    std::vector<unsigned> png_jobs(count, 0);
+    std::vector<std::atomic<int>> visits(count);
+    std::atomic<int> small_running(0);
+    std::atomic<bool> large_overlapped(false);
+    parallel_for_large_last(jobs, count, large_png, [&](uint32_t i, unsigned worker, unsigned item_jobs) {
+        CHECK(worker < jobs);
+        ++visits[i];
+        png_jobs[i] = item_jobs;
+        if (large_png(i)) {
+            large_overlapped = large_overlapped || small_running;
+        } else {
+            ++small_running;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            --small_running;
+        }
+    });
+
+    for (uint32_t i=0; i<count; ++i) {
+        CHECK_EQUAL(visits[i].load(), 1);
+        CHECK_EQUAL(png_jobs[i], large_png(i) ? jobs : 1u);
+    }
+    CHECK(!large_overlapped);
+
+    // Fewer small images than jobs share the ones left over
+    parallel_for_large_last(jobs, 2, [](uint32_t) { return false; }, [&](uint32_t, unsigned, unsigned item_jobs) {
+        CHECK_EQUAL(item_jobs, jobs / 2);
+    });
+}
+
+int main() {
+    test_parallel(1024, 1024, 4);
+    // Rows that don't line up with the deflate pieces, and more jobs than cores
+    test_parallel(1111, 997, 64);
+    test_large_images_get_all_jobs();
+    // Unwritable path
+    std::vector<uint8_t> pixels = make_pixels(1024, 1024);
+    CHECK_EQUAL(write_png("/nonexistent-dir/out.png", 1024, 1024, pixels.data(), 2), 1);
+    return check_result();
+}
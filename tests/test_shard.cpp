@@ -0,0 +1,172 @@
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../asset_index.hpp"
+#include "../audio_meta.hpp"
+#include "../shard.hpp"
+#include "check.hpp"
+
+namespace fs = boost::filesystem;
+
+// Images and sounds with these payload sizes, laid out back to back with a 16 byte header each
+static const std::vector<uint32_t> image_sizes = {900, 100, 500, 500, 50, 2000, 30};
+static const std::vector<uint32_t> sound_sizes = {700, 40, 1200};
+
+static AssetIndex make_index() {
+    AssetIndex index;
+    uint32_t offset = 0x100;
+    uint32_t entry = 0;
+    auto add_entry = [&](uint32_t size) {
+        index.entry_offset.push_back(offset);
+        index.payload_offset.push_back(offset + 16);
+        index.payload_size.push_back(size);
+        for (int field=0; field<ASSET_FIELD_COUNT; ++field) {
+            index.fields[field].push_back(0);
+        }
+        offset += 16 + size;
+        ++entry;
+    };
+
+    index.section_begin[SECTION_IMAGES] = entry;
+    for (uint32_t size : image_sizes) add_entry(size);
+    index.section_begin[SECTION_SOUNDS] = entry;
+    for (uint32_t size : sound_sizes) add_entry(size);
+    for (int section=SECTION_FONTS; section<=SECTION_COUNT; ++section) {
+        index.section_begin[section] = entry;
+    }
+    return index;
+}
+
+static void all_entries(const AssetIndex& index, std::vector<uint32_t> (&entries)[SECTION_COUNT]) {
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        entries[section].clear();
+        for (uint32_t i=0; i<index.count(static_cast<asset_section>(section)); ++i) {
+            entries[section].push_back(i);
+        }
+    }
+}
+
+static void test_parse_shard_spec() {
+    shard_spec shard;
+    CHECK(parse_shard_spec("2/3", shard));
+    CHECK_EQUAL(shard.number, 2u);
+    CHECK_EQUAL(shard.count, 3u);
+    CHECK(parse_shard_spec("1/1", shard));
+    CHECK(!parse_shard_spec("0/3", shard));
+    CHECK(!parse_shard_spec("4/3", shard));
+    CHECK(!parse_shard_spec("1/0", shard));
+    CHECK(!parse_shard_spec("1/2x", shard));
+    CHECK(!parse_shard_spec("1", shard));
+}
+
+static void test_partition() {
+    AssetIndex index = make_index();
+    const uint32_t shard_count = 3;
+
+    std::vector<uint32_t> owner[SECTION_COUNT];
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        owner[section].assign(index.count(static_cast<asset_section>(section)), 0);
+    }
+    std::vector<uint64_t> loads(shard_count);
+
+    for (uint32_t number=1; number<=shard_count; ++number) {
+        std::vector<uint32_t> entries[SECTION_COUNT];
+        all_entries(index, entries);
+        shard_entries(index, entries, {number, shard_count});
+        for (int section=0; section<SECTION_COUNT; ++section) {
+            CHECK(std::is_sorted(entries[section].begin(), entries[section].end()));
+            for (uint32_t entry_number : entries[section]) {
+                CHECK_EQUAL(owner[section][entry_number], 0u);
+                owner[section][entry_number] = number;
+                uint32_t entry = index.begin(static_cast<asset_section>(section)) + entry_number;
+                loads[number - 1] += index.payload_size[entry] + 16;
+            }
+        }
+    }
+
+    // Every entry went to exactly one shard
+    for (int section=0; section<SECTION_COUNT; ++section) {
+        CHECK(std::find(owner[section].begin(), owner[section].end(), 0u) == owner[section].end());
+    }
+
+    // Largest first to the least loaded shard can't be off by more than the largest entry
+    uint64_t largest = *std::max_element(image_sizes.begin(), image_sizes.end()) + 16;
+    auto minmax = std::minmax_element(loads.begin(), loads.end());
+    CHECK(*minmax.second - *minmax.first <= largest);
+
+    // The same input always gives the same shard
+    std::vector<uint32_t> again[SECTION_COUNT];
+    all_entries(index, again);
+    shard_entries(index, again, {2, shard_count});
+    for (uint32_t entry_number : again[SECTION_IMAGES]) {
+        CHECK_EQUAL(owner[SECTION_IMAGES][entry_number], 2u);
+    }
+}
+
+static shard_summary make_summary(uint32_t number, uint32_t count) {
+    shard_summary summary;
+    summary.shard = {number, count};
+    summary.archive_size = 123456;
+    summary.entries[SECTION_IMAGES] = number;
+    summary.bytes[SECTION_IMAGES] = number * 1000;
+    summary.written[SECTION_IMAGES] = number;
+    return summary;
+}
+
+static void test_summaries() {
+    fs::path dir = fs::temp_directory_path() / fs::unique_path("shard-test-%%%%%%%%");
+    fs::create_directories(dir);
+
+    CHECK_EQUAL(shard_summary_filename({2, 3}), "shard-2-of-3.txt");
+
+    shard_summary written = make_summary(2, 3);
+    CHECK_EQUAL(write_shard_summary(dir.string(), written), 0);
+    shard_summary read;
+    CHECK_EQUAL(read_shard_summary((dir / "shard-2-of-3.txt").string(), read), 0);
+    CHECK_EQUAL(read.shard.number, 2u);
+    CHECK_EQUAL(read.archive_size, 123456u);
+    CHECK_EQUAL(read.bytes[SECTION_IMAGES], 2000u);
+    CHECK_EQUAL(read.written[SECTION_SOUNDS], 0u);
+
+    // Shard 3 is still missing
+    CHECK_EQUAL(write_shard_summary(dir.string(), make_summary(1, 3)), 0);
+    std::ostringstream out;
+    CHECK_EQUAL(merge_shard_summaries(dir.string(), out), 1);
+
+    // Each shard leaves part of the audio index, merging puts them back together
+    audio_index_entry sound = {1, "audio1.wav", 10, false, audio_info()};
+    CHECK_EQUAL(write_audio_index((dir / shard_audio_index_filename({1, 3})).string(), {sound}), 0);
+    CHECK_EQUAL(write_shard_summary(dir.string(), make_summary(3, 3)), 0);
+    out.str("");
+    CHECK_EQUAL(merge_shard_summaries(dir.string(), out), 0);
+    CHECK(out.str().find("Merged 3 of 3 shards") != std::string::npos);
+    CHECK(out.str().find("images: 6 of 6 written (6000 bytes)") != std::string::npos);
+    CHECK(fs::exists(dir / AUDIO_INDEX_FILENAME));
+
+    // A summary from a different run
+    shard_summary stale = make_summary(1, 2);
+    CHECK_EQUAL(write_shard_summary(dir.string(), stale), 0);
+    CHECK_EQUAL(merge_shard_summaries(dir.string(), out), 1);
+    fs::remove(dir / shard_summary_filename(stale.shard));
+
+    // A shard number outside of 1..N is rejected rather than indexing past the shards
+    std::ofstream((dir / "shard-9-of-3.txt").string())
+      << "shard 9 3 123456\nimages 0 0 0\nsounds 0 0 0\nfonts 0 0 0\nshaders 0 0 0\nfiles 0 0 0\nplatform 0 0 0\n";
+    CHECK_EQUAL(read_shard_summary((dir / "shard-9-of-3.txt").string(), read), 1);
+    CHECK_EQUAL(merge_shard_summaries(dir.string(), out), 1);
+
+    fs::remove_all(dir);
+    CHECK_EQUAL(merge_shard_summaries(dir.string(), out), 1);
+}
+
+int main() {
+    test_parse_shard_spec();
+    test_partition();
+    test_summaries();
+    return check_result();
+}
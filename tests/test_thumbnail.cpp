@@ -0,0 +1,78 @@
+#include <cstdint>
+#include <vector>
+
+#include "../thumbnail.hpp"
+#include "check.hpp"
+
+// The box filter written out the obvious way, one output pixel at a time
+static std::vector<uint8_t> reference_downsample(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height,
+  uint32_t new_width, uint32_t new_height) {
+    std::vector<uint8_t> out(static_cast<uint64_t>(new_width) * new_height * 4);
+    for (uint32_t y=0; y<new_height; ++y) {
+        uint32_t y0 = static_cast<uint64_t>(y) * height / new_height, y1 = static_cast<uint64_t>(y + 1) * height / new_height;
+        for (uint32_t x=0; x<new_width; ++x) {
+            uint32_t x0 = static_cast<uint64_t>(x) * width / new_width, x1 = static_cast<uint64_t>(x + 1) * width / new_width;
+            uint64_t area = static_cast<uint64_t>(x1 - x0) * (y1 - y0);
+            for (int channel=0; channel<4; ++channel) {
+                uint64_t sum = 0;
+                for (uint32_t sy=y0; sy<y1; ++sy) {
+                    for (uint32_t sx=x0; sx<x1; ++sx) {
+                        sum += pixels[(static_cast<uint64_t>(sy) * width + sx) * 4 + channel];
+                    }
+                }
+                out[(static_cast<uint64_t>(y) * new_width + x) * 4 + channel] = (sum + area / 2) / area;
+            }
+        }
+    }
+    return out;
+}
+
+static std::vector<uint8_t> make_pixels(uint32_t width, uint32_t height) {
+    std::vector<uint8_t> pixels(static_cast<uint64_t>(width) * height * 4);
+    uint32_t noise = 1;
+    for (uint8_t& value : pixels) {
+        noise = noise * 1103515245 + 12345;
+        value = noise >> 24;
+    }
+    return pixels;
+}
+
+static void check_downsample(uint32_t width, uint32_t height, uint32_t max_size) {
+    uint32_t new_width, new_height;
+    thumbnail_size(width, height, max_size, new_width, new_height);
+    std::vector<uint8_t> pixels = make_pixels(width, height);
+    std::vector<uint8_t> expected = reference_downsample(pixels, width, height, new_width, new_height);
+    downsample_box(pixels.data(), width, height, new_width, new_height);
+    pixels.resize(expected.size());
+    CHECK(pixels == expected);
+}
+
+static void test_thumbnail_size() {
+    uint32_t new_width, new_height;
+    thumbnail_size(1000, 500, 100, new_width, new_height);
+    CHECK_EQUAL(new_width, 100u);
+    CHECK_EQUAL(new_height, 50u);
+    thumbnail_size(3, 1000, 100, new_width, new_height);
+    CHECK_EQUAL(new_width, 1u);
+    CHECK_EQUAL(new_height, 100u);
+    thumbnail_size(64, 40, 100, new_width, new_height);
+    CHECK_EQUAL(new_width, 64u);
+    CHECK_EQUAL(new_height, 40u);
+}
+
+static void test_downsample() {
+    // Rows that are and aren't a multiple of 16 bytes, and boxes that don't divide the image evenly
+    check_downsample(64, 48, 16);
+    check_downsample(37, 23, 10);
+    check_downsample(301, 7, 50);
+    check_downsample(5, 300, 7);
+    check_downsample(16, 16, 16);
+    // A box whose sums don't fit in 32 bits
+    check_downsample(4200, 4100, 1);
+}
+
+int main() {
+    test_thumbnail_size();
+    test_downsample();
+    return check_result();
+}
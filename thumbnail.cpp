@@ -0,0 +1,131 @@
+#include "thumbnail.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// The column sums are done 16 bytes at a time where SSE2 (always there on x86-64) or NEON (always
+// there on AArch64) can be used, and one byte at a time everywhere else
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void thumbnail_size(uint32_t width, uint32_t height, uint32_t max_size, uint32_t& new_width, uint32_t& new_height) {
+    new_width = width;
+    new_height = height;
+    if (width <= max_size && height <= max_size) {
+        return;
+    }
+    if (width >= height) {
+        new_width = max_size;
+        new_height = std::max<uint64_t>(1, (static_cast<uint64_t>(height) * max_size + width / 2) / width);
+    } else {
+        new_height = max_size;
+        new_width = std::max<uint64_t>(1, (static_cast<uint64_t>(width) * max_size + height / 2) / height);
+    }
+}
+
+// Adds `count` bytes to as many 32-bit sums
+static void add_row(uint32_t* sums, const uint8_t* source, uint32_t count) {
+    uint32_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        const __m128i widened[4] = {
+            _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+            _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)
+        };
+        for (int part=0; part<4; ++part) {
+            __m128i* out = reinterpret_cast<__m128i*>(sums + i + part * 4);
+            _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out), widened[part]));
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t bytes = vld1q_u8(source + i);
+        uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+        uint16x8_t high = vmovl_u8(vget_high_u8(bytes));
+        vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(low)));
+        vst1q_u32(sums + i + 4, vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(low)));
+        vst1q_u32(sums + i + 8, vaddw_u16(vld1q_u32(sums + i + 8), vget_low_u16(high)));
+        vst1q_u32(sums + i + 12, vaddw_u16(vld1q_u32(sums + i + 12), vget_high_u16(high)));
+    }
+#endif
+    for (; i < count; ++i) {
+        sums[i] += source[i];
+    }
+}
+
+// Adds up the RGBA column sums of columns [begin, end). A pixel's 4 channels make up one vector,
+// added in 32 bits, so the vector paths are only taken if the totals can't overflow that.
+static void sum_columns(const uint32_t* column_sums, uint32_t begin, uint32_t end, bool fits_u32, uint64_t sum[4]) {
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    if (fits_u32) {
+        uint32_t lanes[4];
+#if defined(__SSE2__)
+        __m128i total = _mm_setzero_si128();
+        for (uint32_t column=begin; column<end; ++column) {
+            total = _mm_add_epi32(total, _mm_loadu_si128(reinterpret_cast<const __m128i*>(column_sums + column * 4)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), total);
+#else
+        uint32x4_t total = vdupq_n_u32(0);
+        for (uint32_t column=begin; column<end; ++column) {
+            total = vaddq_u32(total, vld1q_u32(column_sums + column * 4));
+        }
+        vst1q_u32(lanes, total);
+#endif
+        for (int channel=0; channel<4; ++channel) {
+            sum[channel] = lanes[channel];
+        }
+        return;
+    }
+#else
+    (void)fits_u32;
+#endif
+    for (int channel=0; channel<4; ++channel) {
+        sum[channel] = 0;
+    }
+    for (uint32_t column=begin; column<end; ++column) {
+        for (int channel=0; channel<4; ++channel) {
+            sum[channel] += column_sums[column * 4 + channel];
+        }
+    }
+}
+
+void downsample_box(uint8_t* pixels, uint32_t width, uint32_t height, uint32_t new_width, uint32_t new_height) {
+    uint32_t stride = width * 4;
+    std::vector<uint32_t> column_sums(stride);
+
+    std::vector<uint32_t> box_x(new_width + 1);
+    for (uint32_t x=0; x<=new_width; ++x) {
+        box_x[x] = static_cast<uint64_t>(x) * width / new_width;
+    }
+
+    // Output row y only ever overwrites source rows that were already summed up for it
+    // or for an earlier row, so this is safe to do in place.
+    for (uint32_t y=0; y<new_height; ++y) {
+        uint32_t row_start = static_cast<uint64_t>(y) * height / new_height;
+        uint32_t row_end = static_cast<uint64_t>(y + 1) * height / new_height;
+
+        // Most of the work is in here, one pass over each source row adding it to the column sums
+        std::fill(column_sums.begin(), column_sums.end(), 0);
+        for (uint32_t row=row_start; row<row_end; ++row) {
+            add_row(column_sums.data(), pixels + static_cast<uint64_t>(row) * stride, stride);
+        }
+
+        uint8_t* out = pixels + static_cast<uint64_t>(y) * new_width * 4;
+        for (uint32_t x=0; x<new_width; ++x) {
+            uint64_t area = static_cast<uint64_t>(box_x[x + 1] - box_x[x]) * (row_end - row_start);
+            uint64_t sum[4];
+            sum_columns(column_sums.data(), box_x[x], box_x[x + 1], area * 255 <= UINT32_MAX, sum);
+            for (int channel=0; channel<4; ++channel) {
+                out[x * 4 + channel] = (sum[channel] + area / 2) / area;
+            }
+        }
+    }
+}
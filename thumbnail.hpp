@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// Size of an image scaled down to fit in a max_size x max_size box, keeping the aspect ratio.
+// Images that already fit are left as they are.
+void thumbnail_size(uint32_t width, uint32_t height, uint32_t max_size, uint32_t& new_width, uint32_t& new_height);
+
+// Scales RGBA pixels down in place with a box (area averaging) filter. The result is stored
+// tightly packed at the start of `pixels`. new_width/new_height can't be larger than the originals.
+void downsample_box(uint8_t* pixels, uint32_t width, uint32_t height, uint32_t new_width, uint32_t new_height);
@@ -3,57 +3,109 @@
 #include <stdexcept>
 #include <cstdlib>
 #include <cstdint>
+#include <algorithm>
+#include <new>
 
-uint16_t read_little_endian_u16(const uint8_t* const data) {
-    return *data | (*(data + 1) << 8);
-}
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
 
-uint32_t read_little_endian_u32(const uint8_t* const data) {
-    return *data | (*(data + 1) << 8) | (*(data + 2) << 16) | (*(data + 3) << 24);
-}
+class MallocAllocator : public BufferAllocator {
+public:
+    uint8_t* allocate(uint32_t& size) override {
+        return static_cast<uint8_t*>(malloc(size));
+    }
 
-float read_little_endian_f32(const uint8_t* const data) {
-    uint32_t tmp = (*data | (*(data + 1) << 8) | (*(data + 2) << 16) | (*(data + 3) << 24));
-    return *(float*)(&tmp);
-}
+    uint8_t* reallocate(uint8_t* data, uint32_t, uint32_t& size) override {
+        return static_cast<uint8_t*>(realloc(data, size));
+    }
 
-void write_little_endian_u16(uint8_t* data, uint16_t val) {
-    *data = val & 0xff;
-    *(data + 1) = val >> 8;
-}
+    void deallocate(uint8_t* data, uint32_t) override {
+        free(data);
+    }
+};
 
-void write_little_endian_u32(uint8_t *data, uint32_t val) {
-    *data = val & 0xff;
-    *(data + 1) = (val >> 8) & 0xff;
-    *(data + 2) = (val >> 16) & 0xff;
-    *(data + 3) = (val >> 24) & 0xff;
+BufferAllocator& malloc_allocator() {
+    static MallocAllocator allocator;
+    return allocator;
 }
 
-void write_little_endian_f32(uint8_t *data, float val) {
-    uint32_t tmp = *(uint32_t*)(&val);
-    *data = tmp & 0xff;
-    *(data + 1) = (tmp >> 8) & 0xff;
-    *(data + 2) = (tmp >> 16) & 0xff;
-    *(data + 3) = (tmp >> 24) & 0xff;
+uint8_t* BufferAllocator::reallocate(uint8_t* data, uint32_t old_size, uint32_t& size) {
+    uint8_t* new_data = allocate(size);
+    if (new_data) {
+        memcpy(new_data, data, old_size < size ? old_size : size);
+        deallocate(data, old_size);
+    }
+    return new_data;
 }
 
-Buffer::Buffer(uint32_t size) {
+Buffer::Buffer(uint32_t size) : Buffer(size, malloc_allocator()) {}
+
+Buffer::Buffer(uint32_t size, BufferAllocator& allocator) {
     this->size = size;
-    this->buffer = static_cast<uint8_t*>(malloc(size));
+    this->capacity = size;
+    this->allocator = &allocator;
+    this->buffer = allocator.allocate(this->capacity);
+    if (!this->buffer && size) {
+        throw std::bad_alloc();
+    }
 }
 
-Buffer::Buffer(FILE* file) {
+Buffer::Buffer(FILE* file) : Buffer(file, Buffer::OWNED) {}
+
+Buffer::Buffer(FILE* file, Buffer::Storage storage) {
+#ifdef __linux__
+    if (storage == Buffer::MAPPED) {
+        struct stat st;
+        int fd = fileno(file);
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            // Private and writable so that the write_* functions behave the same as with an owned buffer
+            void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                this->size = st.st_size;
+                this->capacity = this->size;
+                this->buffer = static_cast<uint8_t*>(map);
+                this->storage = Buffer::MAPPED;
+                return;
+            }
+        }
+    }
+#endif
+    (void)storage;
     long prev_seek = ftell(file);
     fseek(file, 0, SEEK_END);
     this->size = ftell(file);
+    this->capacity = this->size;
     this->buffer = static_cast<uint8_t*>(malloc(this->size));
     fseek(file, 0, SEEK_SET);
     fread(this->buffer, this->size, 1, file);
     fseek(file, prev_seek, SEEK_SET);
 }
 
+Buffer::Buffer(uint8_t* data, uint32_t size) {
+    this->size = size;
+    this->capacity = size;
+    this->buffer = data;
+    this->storage = Buffer::VIEW;
+}
+
 Buffer::~Buffer() {
-    free(this->buffer);
+    switch (this->storage) {
+        case Buffer::OWNED:
+            this->allocator->deallocate(this->buffer, this->capacity);
+            break;
+        case Buffer::MAPPED:
+#ifdef __linux__
+            munmap(this->buffer, this->size);
+#endif
+            break;
+        case Buffer::VIEW:
+            break;
+    }
 }
 
 void Buffer::seek(uint32_t offset, Buffer::Whence whence) {
@@ -77,10 +129,25 @@ void Buffer::reserve(uint32_t size) {
 }
 
 void Buffer::reserve(uint32_t size, uint32_t extra_alloc) {
-    if (this->size < size) {
-        this->buffer = static_cast<uint8_t*>(realloc(buffer, size + extra_alloc));
-        this->size = size;
+    if (this->size >= size) {
+        return;
     }
+    if (this->capacity < size) {
+        if (this->storage != Buffer::OWNED) {
+            throw std::logic_error("Buffer::reserve: can't grow a buffer that isn't owned");
+        }
+        uint64_t wanted = static_cast<uint64_t>(size) + extra_alloc;
+        uint64_t doubled = static_cast<uint64_t>(this->capacity) * 2;
+        uint32_t new_capacity = static_cast<uint32_t>(std::min<uint64_t>(std::max(wanted, doubled), UINT32_MAX));
+
+        uint8_t* new_buffer = this->allocator->reallocate(this->buffer, this->capacity, new_capacity);
+        if (!new_buffer) {
+            throw std::bad_alloc();
+        }
+        this->buffer = new_buffer;
+        this->capacity = new_capacity;
+    }
+    this->size = size;
 }
 
 // Made for cases where destination and source overlap and memcpy can't be used
@@ -92,3 +159,69 @@ void Buffer::copy_from_self(uint32_t from, uint32_t count) {
         ++this->offset;
     }
 }
+
+#ifdef __linux__
+// Returns how many bytes are left to copy, in case the kernel gave up partway through
+// (e.g. the filesystems don't support it or the input file is shorter than expected).
+static uint32_t copy_range_in_kernel(int in_fd, int out_fd, uint32_t offset, uint32_t size) {
+    loff_t in_offset = offset;
+    uint32_t remaining = size;
+    while (remaining) {
+        ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, nullptr, remaining, 0);
+        if (copied <= 0) break;
+        remaining -= copied;
+    }
+
+    // copy_file_range doesn't work across filesystems on older kernels, sendfile does.
+    off_t send_offset = in_offset;
+    while (remaining) {
+        ssize_t copied = sendfile(out_fd, in_fd, &send_offset, remaining);
+        if (copied <= 0) break;
+        remaining -= copied;
+    }
+    return remaining;
+}
+
+int write_file_range(const std::string& filename, int in_fd, uint32_t offset, const uint8_t* data, uint32_t size) {
+    int out_fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        return 1;
+    }
+
+    uint32_t remaining = size;
+    if (in_fd >= 0) {
+        remaining = copy_range_in_kernel(in_fd, out_fd, offset, size);
+    }
+
+    const uint8_t* source = data + (size - remaining);
+    while (remaining) {
+        ssize_t written = write(out_fd, source, remaining);
+        if (written <= 0) {
+            close(out_fd);
+            return 1;
+        }
+        source += written;
+        remaining -= written;
+    }
+    return close(out_fd) ? 1 : 0;
+}
+#else
+int write_file_range(const std::string& filename, int, uint32_t, const uint8_t* data, uint32_t size) {
+    FILE* out = fopen(filename.c_str(), "wb");
+    if (!out) {
+        return 1;
+    }
+    size_t written = fwrite(data, 1, size, out);
+    return (fclose(out) || written != size) ? 1 : 0;
+}
+#endif
+
+#ifdef __linux__
+void readahead_file_range(int fd, uint32_t offset, uint32_t size) {
+    if (fd >= 0 && size) {
+        posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+    }
+}
+#else
+void readahead_file_range(int, uint32_t, uint32_t) {}
+#endif
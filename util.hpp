@@ -3,23 +3,96 @@
 #include <cstdint>
 #include <cstring>
 #include <stdexcept>
+#include <string>
+
+// Unchecked loads and stores, callers make sure the bytes are there. memcpy compiles to a single
+// unaligned access on little endian targets, big endian ones additionally swap the bytes.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+inline uint16_t to_little_endian(uint16_t val) { return __builtin_bswap16(val); }
+inline uint32_t to_little_endian(uint32_t val) { return __builtin_bswap32(val); }
+#else
+inline uint16_t to_little_endian(uint16_t val) { return val; }
+inline uint32_t to_little_endian(uint32_t val) { return val; }
+#endif
+
+inline uint16_t read_little_endian_u16(const uint8_t* const data) {
+    uint16_t val;
+    std::memcpy(&val, data, sizeof(val));
+    return to_little_endian(val);
+}
+
+inline uint32_t read_little_endian_u32(const uint8_t* const data) {
+    uint32_t val;
+    std::memcpy(&val, data, sizeof(val));
+    return to_little_endian(val);
+}
+
+inline float read_little_endian_f32(const uint8_t* const data) {
+    uint32_t bits = read_little_endian_u32(data);
+    float val;
+    std::memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+inline void write_little_endian_u16(uint8_t* data, uint16_t val) {
+    val = to_little_endian(val);
+    std::memcpy(data, &val, sizeof(val));
+}
+
+inline void write_little_endian_u32(uint8_t* data, uint32_t val) {
+    val = to_little_endian(val);
+    std::memcpy(data, &val, sizeof(val));
+}
+
+inline void write_little_endian_f32(uint8_t* data, float val) {
+    uint32_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    write_little_endian_u32(data, bits);
+}
+
+// Writes `size` bytes to a new file at `filename`. `data` must point at the same bytes as
+// `offset` in the file open as `in_fd`; when `in_fd` is valid (>= 0), the copy is done by
+// the kernel (copy_file_range, which reflinks where the filesystem supports it, then sendfile)
+// and `data` is only touched if the kernel refuses. Pass -1 to always write from `data`.
+int write_file_range(const std::string& filename, int in_fd, uint32_t offset, const uint8_t* data, uint32_t size);
+
+// Asks the kernel to start reading `size` bytes at `offset` of `fd` into the page cache without
+// waiting for them. Mappings of the file share the page cache, so this helps reads through a
+// MAPPED Buffer too. Does nothing if `fd` isn't valid or the platform has no way to do it.
+void readahead_file_range(int fd, uint32_t offset, uint32_t size);
+
+// Where owned Buffers get their memory from
+class BufferAllocator {
+public:
+    virtual ~BufferAllocator() = default;
 
-uint16_t read_little_endian_u16(const uint8_t* const data);
-
-uint32_t read_little_endian_u32(const uint8_t* const data);
-
-float read_little_endian_f32(const uint8_t* const data);
-
-void write_little_endian_u16(uint8_t* data, uint16_t val);
+    // `size` is the requested size on input and the usable size of the block on output,
+    // which may be larger. Returns nullptr if out of memory.
+    virtual uint8_t* allocate(uint32_t& size) = 0;
+    virtual void deallocate(uint8_t* data, uint32_t size) = 0;
 
-void write_little_endian_u32(uint8_t* data, uint32_t val);
+    // `size` works like in allocate, `old_size` is the size allocate gave for `data`
+    virtual uint8_t* reallocate(uint8_t* data, uint32_t old_size, uint32_t& size);
+};
 
-void write_little_endian_f32(uint8_t* data, float val);
+// Plain malloc/realloc/free
+BufferAllocator& malloc_allocator();
 
 class Buffer {
+public:
+    enum Storage {
+        OWNED,      // allocated by the buffer itself, from its BufferAllocator
+        MAPPED,     // a private memory mapping of a file
+        VIEW        // memory owned by someone else (usually another Buffer)
+    };
+
+private:
     uint32_t size;
+    uint32_t capacity;
     uint32_t offset = 0;
     uint8_t* buffer;
+    Storage storage = OWNED;
+    BufferAllocator* allocator = &malloc_allocator();
 
     inline void bounds_check(uint32_t required_size) {
         if (this->offset + required_size > this->size) {
@@ -34,7 +107,12 @@ public:
     };
 
     Buffer(uint32_t size);
+    Buffer(uint32_t size, BufferAllocator& allocator);
     Buffer(FILE* file);
+    // With MAPPED, the file is mapped instead of read into memory if the platform supports it
+    Buffer(FILE* file, Storage storage);
+    // Non-owning, has its own offset so several threads can read the same data through views
+    Buffer(uint8_t* data, uint32_t size);
     Buffer(Buffer&&) = delete;
     ~Buffer();
 
@@ -43,14 +121,17 @@ public:
 
     inline uint32_t get_size() const { return this->size; };
 
+    // Grows the buffer to at least `size`. The allocation grows geometrically (and by at least
+    // extra_alloc more than needed), so writing a little at a time doesn't realloc every time.
     void reserve(uint32_t size);
     void reserve(uint32_t size, uint32_t extra_alloc);
 
+    // Makes sure `size` bytes can be written at the current offset
     inline void ensure_writable(uint32_t size) {
-        reserve(this->size + size);
+        if (this->offset + size > this->size) reserve(this->offset + size);
     }
     inline void ensure_writable(uint32_t size, uint32_t extra_alloc) {
-        reserve(this->size + size, extra_alloc);
+        if (this->offset + size > this->size) reserve(this->offset + size, extra_alloc);
     }
 
     inline uint8_t* at(uint32_t offset) const { return &this->buffer[offset]; };
@@ -98,7 +179,7 @@ public:
 
     inline void write(uint8_t* source, uint32_t count) {
         bounds_check(count);
-        memccpy(this->buffer + offset, source, 1, count);
+        memcpy(this->buffer + offset, source, count);
         this->offset += count;
     }
 